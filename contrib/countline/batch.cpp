@@ -0,0 +1,346 @@
+#include "batch.hpp"
+#include "fileio.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+/// Paths in flight per worker thread.
+constexpr size_t WINDOW_PER_THREAD = 256;
+
+struct Record
+{
+    std::string path;
+    size_t lines = 0;
+    size_t bytes = 0;
+    double elapsed = 0;
+    int error = 0;
+}; /* end struct Record */
+
+Record count_record(std::string path, Options const & options)
+{
+    Record record;
+    record.path = std::move(path);
+    auto const start = std::chrono::steady_clock::now();
+    try
+    {
+        File const file(record.path);
+        struct stat st;
+        if (::fstat(file.fd(), &st) != 0) { throw_errno(record.path); }
+        if (S_ISDIR(st.st_mode)) { throw std::system_error(EISDIR, std::generic_category(), record.path); }
+        record.bytes = static_cast<size_t>(st.st_size);
+        record.lines = count_fd(file.fd(), options);
+    }
+    catch (std::system_error const & e)
+    {
+        record.error = e.code().value();
+    }
+    record.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return record;
+}
+
+/// Append text as a CSV field, quoted when it has to be.
+void append_csv(std::string & out, std::string const & text)
+{
+    if (text.find_first_of(",\"\r\n") == std::string::npos)
+    {
+        out += text;
+        return;
+    }
+    out += '"';
+    for (char const c : text)
+    {
+        if (c == '"') { out += '"'; }
+        out += c;
+    }
+    out += '"';
+}
+
+std::string format_record(Record const & record, BatchFormat format)
+{
+    std::string out;
+    char number[64];
+    if (format == BatchFormat::jsonl)
+    {
+        out += '{';
+        append_json_field(out, "path", record.path);
+        if (record.error)
+        {
+            std::snprintf(number, sizeof(number), "%.6f", record.elapsed);
+            out += ", \"lines\": null, \"bytes\": null, \"elapsed\": ";
+            out += number;
+            out += ", \"error\": \"";
+            append_json(out, std::strerror(record.error));
+            out += "\"}\n";
+        }
+        else
+        {
+            std::snprintf(number, sizeof(number), ", \"lines\": %zu, \"bytes\": %zu, \"elapsed\": %.6f",
+                          record.lines, record.bytes, record.elapsed);
+            out += number;
+            out += ", \"error\": null}\n";
+        }
+    }
+    else
+    {
+        append_csv(out, record.path);
+        if (record.error)
+        {
+            std::snprintf(number, sizeof(number), ",,,%.6f,", record.elapsed);
+            out += number;
+            append_csv(out, std::strerror(record.error));
+        }
+        else
+        {
+            std::snprintf(number, sizeof(number), ",%zu,%zu,%.6f,", record.lines, record.bytes, record.elapsed);
+            out += number;
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+/**
+ * Paths flow from the reader thread through a queue to the workers, whose
+ * records land in a ring of slots indexed by sequence number.  The calling
+ * thread writes the slots in order; the reader waits while the ring is full.
+ */
+class Batch
+{
+public:
+    Batch(FILE * input, FILE * output, BatchOptions const & options)
+      : m_input(input), m_output(output), m_options(options)
+    {
+        m_options.count.nthread = 1;
+        unsigned const nworker = options.nthread ? options.nthread : std::max(1U, std::thread::hardware_concurrency());
+        m_slots.resize(nworker * WINDOW_PER_THREAD);
+        m_ready.resize(m_slots.size(), false);
+        m_threads.emplace_back(&Batch::read, this);
+        for (unsigned it=0; it<nworker; ++it)
+        {
+            m_threads.emplace_back(&Batch::work, this);
+        }
+    }
+
+    ~Batch()
+    {
+        for (std::thread & thread : m_threads) { thread.join(); }
+    }
+
+    size_t write()
+    {
+        if (m_options.format == BatchFormat::csv)
+        {
+            std::fputs("path,lines,bytes,elapsed,error\n", m_output);
+        }
+        size_t nfailed = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            size_t const islot = m_written % m_slots.size();
+            if (!m_ready[islot])
+            {
+                if (m_eof && m_written == m_read) { break; }
+                // Nothing to write yet: let the consumer see what we have.
+                lock.unlock();
+                std::fflush(m_output);
+                lock.lock();
+                m_ready_cv.wait(lock, [&]{ return m_ready[islot] || (m_eof && m_written == m_read); });
+                continue;
+            }
+            Record record = std::move(m_slots[islot]);
+            m_ready[islot] = false;
+            ++m_written;
+            m_space_cv.notify_one();
+            lock.unlock();
+            if (record.error) { ++nfailed; }
+            std::string const text = format_record(record, m_options.format);
+            std::fwrite(text.data(), 1, text.size(), m_output);
+            lock.lock();
+        }
+        lock.unlock();
+        std::fflush(m_output);
+        return nfailed;
+    }
+
+private:
+
+    void read()
+    {
+        char * line = nullptr;
+        size_t capacity = 0;
+        for (;;)
+        {
+            ssize_t length = ::getdelim(&line, &capacity, m_options.separator, m_input);
+            if (length < 0) { break; }
+            if (length && line[length - 1] == m_options.separator) { --length; }
+            if (length == 0) { continue; }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_space_cv.wait(lock, [&]{ return m_read - m_written < m_slots.size(); });
+            m_queue.emplace_back(m_read++, std::string(line, static_cast<size_t>(length)));
+            m_work_cv.notify_one();
+        }
+        std::free(line);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_eof = true;
+        m_work_cv.notify_all();
+        m_ready_cv.notify_all();
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            std::pair<size_t, std::string> item;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work_cv.wait(lock, [&]{ return !m_queue.empty() || m_eof; });
+                if (m_queue.empty()) { return; }
+                item = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            Record record = count_record(std::move(item.second), m_options.count);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t const islot = item.first % m_slots.size();
+            m_slots[islot] = std::move(record);
+            m_ready[islot] = true;
+            if (item.first == m_written) { m_ready_cv.notify_one(); }
+        }
+    }
+
+    FILE * m_input;
+    FILE * m_output;
+    BatchOptions m_options;
+    std::mutex m_mutex;
+    std::condition_variable m_space_cv; // the ring has room
+    std::condition_variable m_work_cv;  // a path is queued, or input ended
+    std::condition_variable m_ready_cv; // the next record is ready
+    std::deque<std::pair<size_t, std::string>> m_queue;
+    std::vector<Record> m_slots;
+    std::vector<bool> m_ready;
+    size_t m_read = 0;    // paths read
+    size_t m_written = 0; // records written
+    bool m_eof = false;
+    std::vector<std::thread> m_threads;
+}; /* end class Batch */
+
+/// Length of the well-formed UTF-8 sequence starting at text[pos], or 0.
+size_t utf8_length(std::string const & text, size_t pos)
+{
+    unsigned char const c = static_cast<unsigned char>(text[pos]);
+    if (c < 0x80) { return 1; }
+    // The range of the second byte excludes overlong forms (E0, F0),
+    // surrogates (ED) and code points above U+10FFFF (F4).
+    size_t length = 0;
+    unsigned char low = 0x80, high = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) { length = 2; }
+    else if (c >= 0xe0 && c <= 0xef) { length = 3; }
+    else if (c >= 0xf0 && c <= 0xf4) { length = 4; }
+    else { return 0; }
+    if (c == 0xe0) { low = 0xa0; }
+    else if (c == 0xed) { high = 0x9f; }
+    else if (c == 0xf0) { low = 0x90; }
+    else if (c == 0xf4) { high = 0x8f; }
+    if (pos + length > text.size()) { return 0; }
+    unsigned char const second = static_cast<unsigned char>(text[pos + 1]);
+    if (second < low || second > high) { return 0; }
+    for (size_t ib=2; ib<length; ++ib)
+    {
+        if ((static_cast<unsigned char>(text[pos + ib]) & 0xc0) != 0x80) { return 0; }
+    }
+    return length;
+}
+
+void append_base64(std::string & out, std::string const & text)
+{
+    static char const digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t it=0; it<text.size(); it+=3)
+    {
+        size_t const nbyte = std::min<size_t>(3, text.size() - it);
+        unsigned long group = 0;
+        for (size_t ib=0; ib<3; ++ib)
+        {
+            group = (group << 8) | (ib < nbyte ? static_cast<unsigned char>(text[it + ib]) : 0);
+        }
+        for (size_t id=0; id<4; ++id)
+        {
+            out += id <= nbyte ? digits[(group >> (18 - 6 * id)) & 0x3f] : '=';
+        }
+    }
+}
+
+} /* end namespace */
+
+bool is_utf8(std::string const & text)
+{
+    for (size_t it=0; it<text.size(); )
+    {
+        size_t const length = utf8_length(text, it);
+        if (!length) { return false; }
+        it += length;
+    }
+    return true;
+}
+
+void append_json(std::string & out, std::string const & text)
+{
+    for (size_t it=0; it<text.size(); )
+    {
+        unsigned char const c = static_cast<unsigned char>(text[it]);
+        size_t const length = utf8_length(text, it);
+        if (c == '"' || c == '\\') { out += '\\'; out += static_cast<char>(c); }
+        else if (c < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else if (length) { out.append(text, it, length); }
+        else { out += "\\ufffd"; }
+        it += length ? length : 1;
+    }
+}
+
+void append_json_field(std::string & out, char const * name, std::string const & text)
+{
+    out += '"';
+    out += name;
+    if (is_utf8(text))
+    {
+        out += "\": \"";
+        append_json(out, text);
+    }
+    else
+    {
+        out += "_b64\": \"";
+        append_base64(out, text);
+    }
+    out += '"';
+}
+
+size_t run_batch(FILE * input, FILE * output, BatchOptions const & options)
+{
+    Batch batch(input, output, options);
+    return batch.write();
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * Batch mode: count a stream of paths and write machine-readable records.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace countline
+{
+
+enum class BatchFormat
+{
+    /// One JSON object per line.
+    jsonl,
+    /// RFC 4180 CSV with a header row.
+    csv,
+}; /* end enum class BatchFormat */
+
+struct BatchOptions
+{
+    /// What separates the paths read: '\n', or '\0' for find -print0.
+    char separator = '\n';
+    BatchFormat format = BatchFormat::jsonl;
+    /// Number of worker threads; 0 uses the number of hardware threads.
+    unsigned nthread = 0;
+    /// How each file is counted (always with one thread).
+    Options count;
+}; /* end struct BatchOptions */
+
+/**
+ * Count the files whose paths are read from input and write one record per
+ * path to output: path, lines, bytes, elapsed seconds and error.
+ *
+ * Paths are counted in parallel but written in input order, each as soon as
+ * every path before it is done.  At most a fixed window of paths is in
+ * flight, so memory stays bounded however many paths stream through.
+ * Returns the number of paths that could not be counted.
+ */
+size_t run_batch(FILE * input, FILE * output, BatchOptions const & options);
+
+/// Whether text is well-formed UTF-8 as RFC 3629 defines it: no overlong
+/// forms, no surrogates and nothing above U+10FFFF.
+bool is_utf8(std::string const & text);
+
+/// Append text as the body of a JSON string.  Text that is not UTF-8 cannot
+/// be written faithfully: each invalid byte becomes U+FFFD.
+void append_json(std::string & out, std::string const & text);
+
+/**
+ * Append the JSON member "name": "text" when text is UTF-8, else
+ * "name_b64": "..." holding the bytes of text in base64, so that paths that
+ * are not UTF-8 are neither lost nor confused with one that is.
+ */
+void append_json_field(std::string & out, char const * name, std::string const & text);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+
+# Benchmark the countline implementations against each other.
+#
+# A corpus of edge cases is generated (empty and tiny files, short and long
+# lines, CRLF and lone CR line ends, no trailing newline, binary data, and one
+# large file), every implementation is run on every file, their counts are
+# checked against each other, and the timings are written as JSON: median
+# latency per file and, for the files large enough to tell, throughput in
+# GB/s.  The exit status is 1 when the implementations disagree.
+
+import argparse
+import json
+import os
+import random
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+
+MIB = 1 << 20
+
+# Files at least this large get a throughput figure.
+THROUGHPUT_MIN_SIZE = 1 * MIB
+
+OUTPUT_RE = re.compile(r'^(\d+) lines in ')
+LINE_END_RE = re.compile(rb'\r\n|\r|\n')
+
+
+def text_lines(rng, count, min_length, max_length, newline=b'\n'):
+    """Random printable lines, each ended by newline."""
+    alphabet = b'abcdefghijklmnopqrstuvwxyz0123456789 .,;:-_'
+    pool = bytes(rng.choice(alphabet) for _ in range(65536))
+    chunks = []
+    for _ in range(count):
+        length = rng.randint(min_length, max_length)
+        start = rng.randrange(len(pool))
+        line = (pool[start:] + pool * (length // len(pool) + 1))[:length]
+        chunks.append(line)
+        chunks.append(newline)
+    return b''.join(chunks)
+
+
+def repeat_to(block, size):
+    """Repeat block up to size bytes, cut after a whole line."""
+    data = block * (size // len(block) + 1)
+    cut = data.rfind(b'\n', 0, size)
+    return data[:cut + 1]
+
+
+def generate_corpus(directory, huge_size, seed):
+    """Write the corpus files into directory; return {name: path}."""
+    rng = random.Random(seed)
+    short = text_lines(rng, 4096, 0, 40)
+    files = {
+        'empty': b'',
+        'tiny': b'one line\n',
+        'tiny_no_eol': b'no newline at the end',
+        'short_lines': repeat_to(short, 8 * MIB),
+        'long_lines': repeat_to(text_lines(rng, 4, 512 * 1024, 2 * MIB), 8 * MIB),
+        'crlf': repeat_to(short, 8 * MIB).replace(b'\n', b'\r\n'),
+        'cr_only': repeat_to(short, 4 * MIB).replace(b'\n', b'\r'),
+        'no_trailing_newline': repeat_to(short, 4 * MIB) + b'last line without newline',
+        'binary': rng.getrandbits(8 * MIB).to_bytes(MIB, 'little'),
+    }
+    paths = {}
+    for name, data in files.items():
+        path = os.path.join(directory, name)
+        with open(path, 'wb') as fobj:
+            fobj.write(data)
+        paths[name] = path
+    # Written in pieces so that the generator stays small in memory; the last
+    # one is cut after a whole line, as repeat_to does, so that the file ends
+    # with a newline (no_trailing_newline covers the other case).
+    path = os.path.join(directory, 'huge')
+    piece = repeat_to(short, 16 * MIB)
+    with open(path, 'wb') as fobj:
+        written = 0
+        while written < huge_size:
+            data = piece
+            if len(data) > huge_size - written:
+                data = data[:data.rfind(b'\n', 0, huge_size - written) + 1]
+                if not data:
+                    break
+            fobj.write(data)
+            written += len(data)
+    paths['huge'] = path
+    return paths
+
+
+def reference_counts(path):
+    """Line counts with universal newlines and with \\n only."""
+    universal = lf = 0
+    last = b''
+    with open(path, 'rb') as fobj:
+        carry = b''
+        while True:
+            block = fobj.read(16 * MIB)
+            if not block:
+                break
+            lf += block.count(b'\n')
+            data = carry + block
+            # A trailing \r may be the first half of \r\n: keep it for the
+            # next block.
+            carry = b'\r' if data.endswith(b'\r') else b''
+            universal += len(LINE_END_RE.findall(data[:len(data) - len(carry)]))
+            last = block[-1:]
+        universal += len(carry)
+    if last and last not in (b'\n', b'\r'):
+        universal += 1
+    if last and last != b'\n':
+        lf += 1
+    return {'universal': universal, 'lf': lf}
+
+
+def default_implementations(bash_script):
+    impls = {}
+    python = os.path.join(ROOT, 'hw0', 'countline.py')
+    if os.path.exists(python):
+        impls['python'] = ['python3', python]
+    wrapper = os.path.join(HERE, 'countline.py')
+    if os.path.exists(wrapper):
+        impls['python-native'] = ['bash', wrapper]
+    if not bash_script and os.path.exists('countline.sh'):
+        bash_script = os.path.abspath('countline.sh')
+    if bash_script:
+        impls['bash'] = ['bash', bash_script]
+    native = os.path.join(HERE, 'countline')
+    if os.access(native, os.X_OK):
+        impls['native'] = [native]
+    return impls
+
+
+def run_once(command, path):
+    """Run one count; return (seconds, lines or None, exit status)."""
+    start = time.perf_counter()
+    proc = subprocess.run(command + [path], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    match = OUTPUT_RE.match(proc.stdout.decode('utf-8', 'replace'))
+    lines = int(match.group(1)) if match and proc.returncode == 0 else None
+    return elapsed, lines, proc.returncode
+
+
+def benchmark(impls, paths, repeat, warmup):
+    results = []
+    for name, path in paths.items():
+        size = os.path.getsize(path)
+        for impl, command in impls.items():
+            for _ in range(warmup):
+                run_once(command, path)
+            times = []
+            counts = set()
+            status = 0
+            for _ in range(repeat):
+                elapsed, lines, returncode = run_once(command, path)
+                times.append(elapsed)
+                counts.add(lines)
+                status = status or returncode
+            median = statistics.median(times)
+            result = {
+                'file': name,
+                'impl': impl,
+                'bytes': size,
+                'lines': counts.pop() if len(counts) == 1 else None,
+                'exit': status,
+                'median_s': median,
+                'min_s': min(times),
+                'mad_s': statistics.median(abs(t - median) for t in times),
+                'gbps': size / median / 1e9 if size >= THROUGHPUT_MIN_SIZE else None,
+            }
+            results.append(result)
+            gbps = '' if result['gbps'] is None else ' {:.3f} GB/s'.format(result['gbps'])
+            sys.stderr.write('{:<20} {:<14} {:>10} lines {:9.2f} ms{}\n'.format(
+                name, impl, str(result['lines']), median * 1000, gbps))
+    return results
+
+
+def check_agreement(results, references):
+    """For each file, the counts of all implementations, those matching neither
+    reference count, and whether they agree."""
+    agreement = {}
+    for result in results:
+        entry = agreement.setdefault(result['file'], {'counts': {}, 'reference': references[result['file']]})
+        entry['counts'][result['impl']] = result['lines']
+    for entry in agreement.values():
+        expected = set(entry['reference'].values())
+        entry['unexpected'] = sorted(impl for impl, count in entry['counts'].items() if count not in expected)
+        entry['agree'] = len(set(entry['counts'].values())) == 1 and not entry['unexpected']
+    return agreement
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark countline implementations on a generated corpus.')
+    parser.add_argument('--impl', action='append', default=[], metavar='NAME=COMMAND',
+                        help='add an implementation; the file name is appended to COMMAND')
+    parser.add_argument('--only', action='append', default=[], metavar='NAME',
+                        help='run only these implementations')
+    parser.add_argument('--bash', default=os.environ.get('COUNTLINE_SH'), metavar='PATH',
+                        help='the bash reimplementation (default $COUNTLINE_SH, or ./countline.sh)')
+    parser.add_argument('--corpus', metavar='DIR',
+                        help='generate the corpus here and keep it (default: a temporary directory)')
+    parser.add_argument('--huge-size', type=int, default=256, metavar='MIB',
+                        help='size of the large file in MiB (default 256)')
+    parser.add_argument('--repeat', type=int, default=5, help='timed runs per file (default 5)')
+    parser.add_argument('--warmup', type=int, default=1, help='untimed runs per file (default 1)')
+    parser.add_argument('--seed', type=int, default=2024)
+    parser.add_argument('--output', '-o', metavar='FILE', help='write the JSON report here (default stdout)')
+    args = parser.parse_args()
+
+    impls = default_implementations(args.bash)
+    for spec in args.impl:
+        name, sep, command = spec.partition('=')
+        if not sep or not name or not command:
+            parser.error('--impl takes NAME=COMMAND, not {!r}'.format(spec))
+        impls[name] = shlex.split(command)
+    if args.only:
+        impls = {name: command for name, command in impls.items() if name in args.only}
+    if not impls:
+        parser.error('no implementation to run')
+
+    with tempfile.TemporaryDirectory(prefix='countline-bench-') as tmp:
+        directory = args.corpus or tmp
+        os.makedirs(directory, exist_ok=True)
+        sys.stderr.write('generating the corpus in {}\n'.format(directory))
+        paths = generate_corpus(directory, args.huge_size * MIB, args.seed)
+        references = {name: reference_counts(path) for name, path in paths.items()}
+        sizes = {name: os.path.getsize(path) for name, path in paths.items()}
+        results = benchmark(impls, paths, args.repeat, args.warmup)
+
+    agreement = check_agreement(results, references)
+    report = {
+        'implementations': {name: command for name, command in impls.items()},
+        'repeat': args.repeat,
+        'corpus': {name: {'bytes': sizes[name], 'reference': references[name]} for name in paths},
+        'results': results,
+        'agreement': agreement,
+    }
+    text = json.dumps(report, indent=2) + '\n'
+    if args.output:
+        with open(args.output, 'w') as fobj:
+            fobj.write(text)
+    else:
+        sys.stdout.write(text)
+
+    disagree = sorted(name for name, entry in agreement.items() if not entry['agree'])
+    if disagree:
+        sys.stderr.write('implementations disagree on: {}\n'.format(', '.join(disagree)))
+        for name in disagree:
+            for impl in agreement[name]['unexpected']:
+                sys.stderr.write('{}: {} counts {} lines, the reference {}\n'.format(
+                    name, impl, agreement[name]['counts'][impl], agreement[name]['reference']))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
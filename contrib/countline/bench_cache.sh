@@ -0,0 +1,82 @@
+#!/bin/bash
+#
+# Compare the page-cache modes of countline on a cold and on a warm cache.
+#
+# usage: bench_cache.sh [FILE] [REPEAT]
+#
+# Without FILE, a 256 MiB file of random text is generated in a temporary
+# directory.  For every mode, the file is first evicted from the page cache
+# (dd iflag=nocache, which drops only clean pages and needs no privilege) and
+# counted cold, then counted REPEAT times (default 3) warm.  The table shows
+# the cold time, the best warm time, and how much of the file is cached after
+# the cold run: "drop" and "direct" should leave it as it was.
+
+set -e
+
+bench_path="$(realpath $(dirname ${BASH_SOURCE[0]}))"
+countline="${COUNTLINE:-$bench_path/countline}"
+repeat="${2:-3}"
+
+if [ ! -x "$countline" ] ; then
+    echo "$countline not found; run make first" >&2
+    exit 1
+fi
+
+if [ -n "$1" ] ; then
+    file="$1"
+else
+    tmp_dir=$(mktemp -d -t countline-bench-XXXXXXXXXX)
+    trap 'rm -rf "$tmp_dir"' EXIT
+    file="$tmp_dir/data.txt"
+    echo "generating $file ..."
+    head -c 192M /dev/urandom | base64 -w 76 > "$file"
+fi
+
+evict() {
+    dd if="$1" iflag=nocache count=0 status=none
+}
+
+# Print the cached bytes of a file, or "-" without fincore(1).
+resident() {
+    if command -v fincore > /dev/null ; then
+        fincore --bytes --noheadings --output RES "$1"
+    else
+        echo "-"
+    fi
+}
+
+# Print the milliseconds one run of countline takes.
+elapsed_ms() {
+    local start=$(date +%s%N)
+    "$countline" "$@" > /dev/null
+    local stop=$(date +%s%N)
+    echo $(( (stop - start) / 1000000 ))
+}
+
+modes=(
+    "mmap:"
+    "populate:--populate"
+    "hugepage:--hugepage"
+    "pread-j4:-j4"
+    "drop:--page-cache=drop"
+    "direct:--page-cache=direct"
+)
+
+size=$(stat -c %s "$file")
+echo "file: $file ($size bytes), $("$countline" "$file")"
+printf "%-10s %10s %10s %14s\n" mode "cold ms" "warm ms" "cached after"
+for entry in "${modes[@]}" ; do
+    name="${entry%%:*}"
+    args=(${entry#*:})
+    evict "$file"
+    cold=$(elapsed_ms "${args[@]}" "$file")
+    cached=$(resident "$file")
+    warm=
+    for run in $(seq "$repeat") ; do
+        ms=$(elapsed_ms "${args[@]}" "$file")
+        if [ -z "$warm" ] || [ "$ms" -lt "$warm" ] ; then warm=$ms ; fi
+    done
+    printf "%-10s %10s %10s %14s\n" "$name" "$cold" "$warm" "$cached"
+done
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
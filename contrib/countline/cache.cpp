@@ -0,0 +1,247 @@
+#include "cache.hpp"
+#include "fileio.hpp"
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+constexpr char const * CACHE_HEADER = "countline-cache 2";
+constexpr size_t FINGERPRINT_SIZE = 4096;
+constexpr size_t SCAN_BUFFER_SIZE = 256 << 10;
+constexpr size_t MAX_ENTRIES = 65536;
+
+/// FNV-1a hash of the FINGERPRINT_SIZE bytes that end at offset.
+uint64_t fingerprint(int fd, uint64_t offset)
+{
+    char buffer[FINGERPRINT_SIZE];
+    size_t const length = static_cast<size_t>(std::min<uint64_t>(offset, FINGERPRINT_SIZE));
+    size_t const nread = pread_full(fd, buffer, length, static_cast<off_t>(offset - length));
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t it=0; it<nread; ++it)
+    {
+        hash = (hash ^ static_cast<unsigned char>(buffer[it])) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/// Feed the bytes in [begin, end) of fd, the tail appended since the last
+/// count, to counter.
+void scan_range(int fd, uint64_t begin, uint64_t end, LineCounter & counter)
+{
+    std::unique_ptr<char[]> buffer(new char[SCAN_BUFFER_SIZE]);
+    while (begin < end)
+    {
+        size_t const length = static_cast<size_t>(std::min<uint64_t>(SCAN_BUFFER_SIZE, end - begin));
+        size_t const nread = pread_full(fd, buffer.get(), length, static_cast<off_t>(begin));
+        if (nread == 0) { break; } // truncated meanwhile
+        counter.update(buffer.get(), nread);
+        begin += nread;
+    }
+}
+
+/// Create the directories leading to path.
+void make_parents(std::string const & path)
+{
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+    {
+        ::mkdir(path.substr(0, pos).c_str(), 0755);
+    }
+}
+
+} /* end namespace */
+
+LineCache::LineCache(std::string path, Newline newline)
+  : m_path(std::move(path)), m_newline(newline), m_entries(load(m_path))
+{}
+
+std::string LineCache::default_path()
+{
+    if (char const * xdg = std::getenv("XDG_CACHE_HOME"))
+    {
+        if (*xdg) { return std::string(xdg) + "/countline/cache"; }
+    }
+    char const * home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/countline/cache";
+}
+
+std::map<LineCache::Key, LineCache::Entry> LineCache::load(std::string const & path)
+{
+    std::map<Key, Entry> entries;
+    std::unique_ptr<FILE, int (*)(FILE *)> stream(std::fopen(path.c_str(), "r"), std::fclose);
+    if (!stream) { return entries; }
+    char header[64] = "";
+    if (!std::fgets(header, sizeof(header), stream.get())
+        || std::string(header) != std::string(CACHE_HEADER) + "\n")
+    {
+        return entries; // unknown format: start over
+    }
+    uint64_t dev, ino;
+    unsigned last;
+    char newline;
+    Entry entry;
+    while (std::fscanf(stream.get(), "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNd64 " %" SCNu64 " %u %c %" SCNx64 " %" SCNd64 "\n",
+                       &dev, &ino, &entry.size, &entry.mtime, &entry.newlines, &last, &newline,
+                       &entry.fingerprint, &entry.used) == 9)
+    {
+        entry.last = static_cast<unsigned char>(last);
+        entry.newline = newline == 'l' ? Newline::lf : Newline::universal;
+        entries[Key(dev, ino)] = entry;
+    }
+    return entries;
+}
+
+size_t LineCache::count(std::string const & path, Outcome * outcome, unsigned max_thread)
+{
+    File const file(path);
+    struct stat st;
+    if (::fstat(file.fd(), &st) != 0) { throw_errno(path); }
+    Key const key(static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino));
+    uint64_t const size = static_cast<uint64_t>(st.st_size);
+    int64_t const mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    bool found = false;
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto const it = m_entries.find(key);
+        if (it != m_entries.end() && it->second.newline == m_newline)
+        {
+            found = true;
+            entry = it->second;
+        }
+    }
+
+    Outcome result = Outcome::full;
+    try
+    {
+        if (found && size == entry.size && mtime == entry.mtime)
+        {
+            result = Outcome::hit;
+        }
+        else if (found && size > entry.size && fingerprint(file.fd(), entry.size) == entry.fingerprint)
+        {
+            result = Outcome::tail;
+            LineCounter counter(m_newline);
+            scan_range(file.fd(), entry.size, size, counter);
+            entry.newlines += counter.newlines();
+            // A "\r\n" split at the old end was counted on both sides.
+            if (m_newline == Newline::universal && entry.last == '\r' && counter.first() == '\n') { --entry.newlines; }
+            if (counter.bytes()) { entry.last = static_cast<unsigned char>(counter.last()); }
+            entry.size += counter.bytes();
+        }
+        else
+        {
+            // Counted like an uncached file, with as many threads as its size
+            // calls for; the last byte tells the line ends from the lines.
+            Options options;
+            options.nthread = 0;
+            options.max_thread = max_thread;
+            options.newline = m_newline;
+            size_t const lines = count_regular(file.fd(), static_cast<size_t>(size), options);
+            char last = '\n';
+            if (size && pread_full(file.fd(), &last, 1, static_cast<off_t>(size - 1)) != 1)
+            {
+                throw std::system_error(EIO, std::generic_category()); // truncated meanwhile
+            }
+            entry.newlines = lines - ((lines && !is_line_end(last, m_newline)) ? 1 : 0);
+            entry.newline = m_newline;
+            entry.last = static_cast<unsigned char>(last);
+            entry.size = size;
+        }
+        if (result != Outcome::hit)
+        {
+            entry.mtime = mtime;
+            entry.fingerprint = fingerprint(file.fd(), entry.size);
+        }
+    }
+    catch (std::system_error const & e)
+    {
+        throw std::system_error(e.code(), path);
+    }
+    entry.used = static_cast<int64_t>(std::time(nullptr));
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries[key] = entry;
+        m_updated[key] = entry;
+    }
+    if (outcome) { *outcome = result; }
+    return static_cast<size_t>(entry.newlines) + ((entry.size && !is_line_end(static_cast<char>(entry.last), m_newline)) ? 1 : 0);
+}
+
+void LineCache::save()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_updated.empty()) { return; }
+
+    make_parents(m_path);
+    std::string const lock_path = m_path + ".lock";
+    int const lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) { throw_errno(lock_path); }
+    std::unique_ptr<int, void (*)(int *)> lock_guard(new int(lock_fd), [](int * fd)
+    {
+        ::flock(*fd, LOCK_UN);
+        ::close(*fd);
+        delete fd;
+    });
+    ::flock(lock_fd, LOCK_EX);
+
+    // Merge with what other processes saved since we loaded.
+    std::map<Key, Entry> entries = load(m_path);
+    for (auto const & updated : m_updated)
+    {
+        entries[updated.first] = updated.second;
+    }
+    if (entries.size() > MAX_ENTRIES)
+    {
+        std::vector<std::pair<int64_t, Key>> ages;
+        for (auto const & item : entries) { ages.emplace_back(item.second.used, item.first); }
+        std::sort(ages.begin(), ages.end());
+        size_t const excess = entries.size() - MAX_ENTRIES;
+        for (size_t it=0; it<excess; ++it) { entries.erase(ages[it].second); }
+    }
+
+    std::string const tmp_path = m_path + ".tmp." + std::to_string(::getpid());
+    std::unique_ptr<std::string const, void (*)(std::string const *)> tmp_guard(nullptr, [](std::string const * path)
+    {
+        ::unlink(path->c_str());
+    });
+    {
+        std::unique_ptr<FILE, int (*)(FILE *)> stream(std::fopen(tmp_path.c_str(), "w"), std::fclose);
+        if (!stream) { throw_errno(tmp_path); }
+        // Removed again unless it replaces the cache.
+        tmp_guard.reset(&tmp_path);
+        std::fprintf(stream.get(), "%s\n", CACHE_HEADER);
+        for (auto const & item : entries)
+        {
+            Entry const & entry = item.second;
+            std::fprintf(stream.get(), "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRId64 " %" PRIu64 " %u %c %" PRIx64 " %" PRId64 "\n",
+                         item.first.first, item.first.second, entry.size, entry.mtime, entry.newlines,
+                         static_cast<unsigned>(entry.last), entry.newline == Newline::lf ? 'l' : 'u',
+                         entry.fingerprint, entry.used);
+        }
+        if (std::fclose(stream.release()) != 0) { throw_errno(tmp_path); }
+    }
+    if (::rename(tmp_path.c_str(), m_path.c_str()) != 0) { throw_errno(m_path); }
+    tmp_guard.release();
+    m_updated.clear();
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
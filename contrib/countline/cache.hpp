@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * Persistent line-count cache for files that only grow, such as logs.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace countline
+{
+
+/**
+ * Line counts remembered across runs, keyed by (device, inode).
+ *
+ * Each entry records the size and modification time at which the file was
+ * counted, the line ends up to that offset, its last byte, and a fingerprint
+ * of the bytes just before the offset.  When the file is unchanged the count
+ * is returned without reading it; when it has only grown and the fingerprint
+ * still matches, only the new tail is read.  A smaller file, a changed
+ * fingerprint (truncated and rewritten in place) or a new inode (rotated)
+ * makes it counted from scratch by count_regular(), and so does an entry
+ * counted with the other Newline mode.
+ *
+ * The cache is a small text file written atomically by rename; concurrent
+ * writers merge their entries under an advisory lock.  Methods are
+ * thread-safe.
+ */
+class LineCache
+{
+public:
+    /// Load the cache stored at path; a missing file is an empty cache.
+    explicit LineCache(std::string path, Newline newline = Newline::universal);
+
+    /// $XDG_CACHE_HOME/countline/cache, or ~/.cache/countline/cache.
+    static std::string default_path();
+
+    /// How count() obtained the result.
+    enum class Outcome { hit, tail, full };
+
+    /**
+     * Count the lines of the file at path, reusing the cached state when
+     * possible, with at most max_thread threads (0 for the number of hardware
+     * threads).  Throws std::system_error on failure.
+     */
+    size_t count(std::string const & path, Outcome * outcome = nullptr, unsigned max_thread = 0);
+
+    /// Write the entries updated by count() back to the cache file.
+    void save();
+
+private:
+
+    struct Entry
+    {
+        uint64_t size = 0;
+        int64_t mtime = 0; // nanoseconds
+        uint64_t newlines = 0;
+        unsigned char last = '\n';
+        Newline newline = Newline::universal;
+        uint64_t fingerprint = 0;
+        int64_t used = 0; // seconds since the epoch
+    }; /* end struct Entry */
+
+    using Key = std::pair<uint64_t, uint64_t>; // (device, inode)
+
+    static std::map<Key, Entry> load(std::string const & path);
+
+    std::string m_path;
+    Newline m_newline;
+    std::mutex m_mutex;
+    std::map<Key, Entry> m_entries;
+    std::map<Key, Entry> m_updated;
+}; /* end class LineCache */
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,164 @@
+#pragma once
+
+/*
+ * Native line-counting engine for countline.
+ *
+ * The engine reproduces what ``countline.py`` reports for a file (the number
+ * of items ``readlines()`` returns), without building the list of lines.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace countline
+{
+
+/**
+ * Count the occurrences of the byte c in [data, data+size).
+ *
+ * The implementation is selected once at run time: AVX-512BW, AVX2, or a
+ * portable scalar loop.
+ */
+size_t count_byte(char const * data, size_t size, char c);
+
+/// Name of the kernel count_byte() dispatches to ("avx512", "avx2", "scalar").
+char const * kernel_name();
+
+/// What ends a line.
+enum class Newline
+{
+    /// "\n", "\r\n" and a lone "\r", as Python's text-mode readlines() has it.
+    universal,
+    /// "\n" only, as wc -l and binary-mode readlines() have it.
+    lf,
+}; /* end enum class Newline */
+
+/**
+ * Count the line ends in [data, data+size).
+ *
+ * In universal mode a "\r" at the very end counts as a line end; the caller
+ * that feeds a stream in pieces subtracts one when the next piece starts with
+ * the "\n" completing it (LineCounter does).  Vectorized like count_byte():
+ * the "\r\n" pairs are found by shifting the carriage-return bit mask onto
+ * the newline mask, carrying the top bit from one block to the next.
+ */
+size_t count_line_ends(char const * data, size_t size, Newline newline);
+
+/// Whether a stream whose last byte is c ends with a complete line.
+inline bool is_line_end(char c, Newline newline)
+{
+    return c == '\n' || (c == '\r' && newline == Newline::universal);
+}
+
+/**
+ * Accumulate the line count of a byte stream fed in arbitrary pieces.
+ */
+class LineCounter
+{
+public:
+    explicit LineCounter(Newline newline = Newline::universal) : m_newline(newline) {}
+
+    void update(char const * data, size_t size);
+    /// Account for a piece of the stream that other counted right after ours.
+    void append(LineCounter const & other);
+
+    /// Number of line ends seen.
+    size_t newlines() const { return m_newlines; }
+    /// Number of bytes seen.
+    size_t bytes() const { return m_bytes; }
+    /// First byte seen ('\n' before any).
+    char first() const { return m_first; }
+    /// Last byte seen ('\n' before any).
+    char last() const { return m_last; }
+    /// Number of lines, counting a final line without a line end.
+    size_t lines() const { return m_newlines + ((m_bytes && !is_line_end(m_last, m_newline)) ? 1 : 0); }
+
+private:
+    Newline m_newline;
+    size_t m_newlines = 0;
+    size_t m_bytes = 0;
+    char m_first = '\n';
+    char m_last = '\n';
+}; /* end class LineCounter */
+
+/// What counting a regular file does to the page cache.
+enum class PageCache
+{
+    /// Map the file and leave what was read cached.
+    keep,
+    /// Read with pread() and evict, chunk by chunk, the pages that were not
+    /// cached before (posix_fadvise DONTNEED), so hot data stays.
+    drop,
+    /// Bypass the cache with O_DIRECT reads, double-buffered.
+    direct,
+}; /* end enum class PageCache */
+
+/// Tuning knobs of count_file() and count_fd().
+struct Options
+{
+    /// Number of threads counting a regular file; 0 selects it from the size.
+    unsigned nthread = 1;
+    /// Most threads nthread 0 may select; 0 for the number of hardware
+    /// threads.
+    unsigned max_thread = 0;
+    /// Count the decompressed content of gzip, zstd and xz input.
+    bool decompress = false;
+    /// What ends a line.
+    Newline newline = Newline::universal;
+    /// What to do with the page cache.
+    PageCache page_cache = PageCache::keep;
+    /// Fault the whole mapping in at once (MAP_POPULATE).
+    bool populate = false;
+    /// Ask for huge pages on the mapping (MADV_HUGEPAGE).
+    bool hugepage = false;
+}; /* end struct Options */
+
+/**
+ * Number of threads worth using for a regular file of size bytes.
+ *
+ * Files smaller than a few chunks are counted by a single thread; beyond that
+ * one thread is added per 32 MiB up to the number of hardware threads.
+ */
+unsigned auto_thread_count(size_t size);
+
+/**
+ * Count the lines of the file at path.
+ *
+ * With one thread, regular files are memory-mapped.  With more, the file is
+ * split into aligned chunks that worker threads read with pread() and count
+ * independently.  Anything that cannot be mapped (pipes, character devices)
+ * is read through a buffer.  options.page_cache selects reads that keep the
+ * page cache as it was.  Throws std::system_error on failure.
+ */
+size_t count_file(std::string const & path, Options const & options = Options());
+
+/**
+ * Count the lines readable from the open file descriptor fd, from its current
+ * offset.  Only a regular file at offset 0 is mapped or split into chunks;
+ * elsewhere it is read like a stream.
+ */
+size_t count_fd(int fd, Options const & options = Options());
+
+/**
+ * Count the lines of the first size bytes of the regular file fd, mapped or
+ * in chunks as count_fd() would, without looking for compressed content.
+ */
+size_t count_regular(int fd, size_t size, Options const & options = Options());
+
+/// Size of the single buffer count_stream() reads into.
+constexpr size_t STREAM_BUFFER_SIZE = 256 << 10;
+
+/**
+ * Count the lines read from fd until end of file.
+ *
+ * Works on any descriptor, seekable or not, in constant memory: the data pass
+ * through one page-aligned buffer of STREAM_BUFFER_SIZE bytes.  A pipe is
+ * enlarged so that each read() drains more data per wake-up.  With
+ * options.decompress, compressed input is decoded on the fly.
+ */
+size_t count_stream(int fd, Options const & options = Options());
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,387 @@
+#include "daemon.hpp"
+#include "fileio.hpp"
+#include "unixsocket.hpp"
+
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+/// Seconds a client has to send its request and read the reply.
+constexpr unsigned CLIENT_TIMEOUT = 30;
+
+/// Milliseconds to wait before accepting again when out of descriptors.
+constexpr int ACCEPT_BACKOFF = 100;
+
+/*
+ * A request is three NUL-terminated fields, "count", the newline mode
+ * ("universal" or "lf") and an absolute path, after which the client shuts
+ * down its side.  The reply is one line, "ok LINES" or "error ERRNO".
+ */
+
+char const * mode_name(Newline newline)
+{
+    return newline == Newline::lf ? "lf" : "universal";
+}
+
+/// What a count depends on, as stat() reports it.
+struct Identity
+{
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    struct timespec mtime = {0, 0};
+    struct timespec ctime = {0, 0};
+
+    explicit Identity(struct stat const & st)
+      : dev(st.st_dev), ino(st.st_ino), size(st.st_size), mtime(st.st_mtim), ctime(st.st_ctim)
+    {}
+
+    bool operator==(Identity const & other) const
+    {
+        return dev == other.dev && ino == other.ino && size == other.size
+            && mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec
+            && ctime.tv_sec == other.ctime.tv_sec && ctime.tv_nsec == other.ctime.tv_nsec;
+    }
+}; /* end struct Identity */
+
+class Daemon
+{
+public:
+    Daemon(std::string const & socket_path, DaemonOptions const & options)
+      : m_path(socket_path), m_options(options), m_listen(listen_unix(socket_path))
+    {}
+
+    ~Daemon()
+    {
+        ::unlink(m_path.c_str());
+    }
+
+    void run()
+    {
+        sigset_t stop, saved;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        ::pthread_sigmask(SIG_BLOCK, &stop, &saved);
+        try
+        {
+            Descriptor const signal(::signalfd(-1, &stop, SFD_CLOEXEC), "signalfd");
+            loop(signal.fd());
+        }
+        catch (...)
+        {
+            wait_clients();
+            ::pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+            throw;
+        }
+        wait_clients();
+        ::pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+    }
+
+private:
+
+    struct Entry
+    {
+        Identity identity;
+        size_t lines;
+        uint64_t used;
+    }; /* end struct Entry */
+
+    void loop(int signal_fd)
+    {
+        // After accept() ran out of descriptors or memory, wait for the
+        // signal alone for ACCEPT_BACKOFF ms; say so the first time only.
+        bool backoff = false;
+        bool reported = false;
+        for (;;)
+        {
+            struct pollfd fds[2] = {
+                {signal_fd, POLLIN, 0},
+                {m_listen->fd(), POLLIN, 0},
+            };
+            if (::poll(fds, backoff ? 1 : 2, backoff ? ACCEPT_BACKOFF : -1) < 0)
+            {
+                if (errno == EINTR) { continue; }
+                throw_errno("poll");
+            }
+            if (fds[0].revents)
+            {
+                // Consume the signal, or restoring the mask would deliver it.
+                struct signalfd_siginfo info;
+                ssize_t const nread = ::read(signal_fd, &info, sizeof(info));
+                static_cast<void>(nread);
+                return;
+            }
+            if (backoff)
+            {
+                backoff = false;
+                continue;
+            }
+            int const fd = ::accept4(m_listen->fd(), nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    // The connection stays queued: retry once clients have
+                    // closed some descriptors instead of spinning on it.
+                    if (!reported) { std::fprintf(stderr, "countline: accept: %s; retrying\n", std::strerror(errno)); }
+                    backoff = reported = true;
+                }
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_clients;
+            }
+            try
+            {
+                std::thread(&Daemon::serve, this, fd).detach();
+            }
+            catch (std::system_error const & )
+            {
+                serve(fd); // out of threads: serve it here
+            }
+        }
+    }
+
+    /// Wait for the threads still serving clients.
+    void wait_clients()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() { return m_clients == 0; });
+    }
+
+    void serve(int fd)
+    {
+        {
+            Descriptor const client(fd, "accept");
+            set_io_timeout(client.fd(), CLIENT_TIMEOUT);
+            std::string request;
+            std::vector<std::string> fields;
+            if (recv_all(client.fd(), request, 64 + PATH_MAX))
+            {
+                for (size_t begin = 0, end; (end = request.find('\0', begin)) != std::string::npos; begin = end + 1)
+                {
+                    fields.push_back(request.substr(begin, end - begin));
+                }
+            }
+            char reply[64];
+            if (fields.size() == 3 && fields[0] == "count" && (fields[1] == "universal" || fields[1] == "lf")
+                && !fields[2].empty() && fields[2][0] == '/')
+            {
+                DaemonReply result;
+                try
+                {
+                    result = count(fields[2], fields[1] == "lf" ? Newline::lf : Newline::universal);
+                }
+                catch (...)
+                {
+                    result.error = EIO;
+                }
+                if (result.error) { std::snprintf(reply, sizeof(reply), "error %d\n", result.error); }
+                else { std::snprintf(reply, sizeof(reply), "ok %zu\n", result.lines); }
+            }
+            else
+            {
+                std::snprintf(reply, sizeof(reply), "error %d\n", EINVAL);
+            }
+            send_all(client.fd(), reply);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_clients == 0) { m_idle.notify_all(); }
+    }
+
+    DaemonReply count(std::string const & path, Newline newline)
+    {
+        DaemonReply reply;
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0)
+        {
+            reply.error = errno;
+            return reply;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            reply.error = EISDIR;
+            return reply;
+        }
+        Identity const identity(st);
+        std::string const key = std::string(mode_name(newline)) + '\0' + path;
+
+        std::promise<DaemonReply> promise;
+        std::shared_future<DaemonReply> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto const found = m_entries.find(key);
+            if (found != m_entries.end() && found->second.identity == identity)
+            {
+                found->second.used = ++m_clock;
+                reply.lines = found->second.lines;
+                return reply;
+            }
+            auto const flight = m_in_flight.find(key);
+            if (flight != m_in_flight.end()) { pending = flight->second; }
+            else { m_in_flight.emplace(key, promise.get_future().share()); }
+        }
+        if (pending.valid()) { return pending.get(); }
+
+        // Count it, remembering the identity seen before reading: a file
+        // that changes meanwhile is counted again on the next request.
+        try
+        {
+            Options options;
+            options.nthread = m_options.nthread;
+            options.newline = newline;
+            options.page_cache = m_options.page_cache;
+            options.populate = m_options.populate;
+            options.hugepage = m_options.hugepage;
+            reply.lines = count_file(path, options);
+        }
+        catch (std::system_error const & e)
+        {
+            reply.error = e.code().value();
+        }
+        catch (std::bad_alloc const & )
+        {
+            reply.error = ENOMEM;
+        }
+        catch (...)
+        {
+            // Anything else reaches the waiters too, rather than a broken
+            // promise.
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_in_flight.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!reply.error)
+            {
+                m_entries.erase(key);
+                m_entries.emplace(key, Entry{identity, reply.lines, ++m_clock});
+                evict();
+            }
+            m_in_flight.erase(key);
+        }
+        promise.set_value(reply);
+        return reply;
+    }
+
+    /// Forget the least recently used half when the cache is over its size.
+    void evict()
+    {
+        if (m_entries.size() <= m_options.max_entries) { return; }
+        std::vector<uint64_t> used;
+        used.reserve(m_entries.size());
+        for (auto const & item : m_entries) { used.push_back(item.second.used); }
+        auto const middle = used.begin() + used.size() / 2;
+        std::nth_element(used.begin(), middle, used.end());
+        for (auto it = m_entries.begin(); it != m_entries.end(); )
+        {
+            if (it->second.used < *middle) { it = m_entries.erase(it); }
+            else { ++it; }
+        }
+    }
+
+    std::string m_path;
+    DaemonOptions m_options;
+    std::unique_ptr<Descriptor> m_listen;
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    size_t m_clients = 0;
+    uint64_t m_clock = 0;
+    std::map<std::string, Entry> m_entries;
+    std::map<std::string, std::shared_future<DaemonReply>> m_in_flight;
+}; /* end class Daemon */
+
+} /* end namespace */
+
+std::string default_socket_path()
+{
+    char const * socket = std::getenv("COUNTLINE_SOCKET");
+    if (socket && *socket) { return socket; }
+    char const * runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) { return std::string(runtime) + "/countline.sock"; }
+    return "/tmp/countline-" + std::to_string(::getuid()) + ".sock";
+}
+
+void run_daemon(std::string const & socket_path, DaemonOptions const & options)
+{
+    Daemon daemon(socket_path, options);
+    daemon.run();
+}
+
+bool query_daemon(std::string const & socket_path, std::string const & path, Newline newline, DaemonReply & reply)
+{
+    std::string absolute = path;
+    if (absolute.empty() || absolute[0] != '/')
+    {
+        char cwd[PATH_MAX];
+        if (!::getcwd(cwd, sizeof(cwd))) { return false; }
+        absolute = std::string(cwd) + '/' + path;
+    }
+    try
+    {
+        std::unique_ptr<Descriptor> const sock = connect_unix(socket_path);
+        set_io_timeout(sock->fd(), CLIENT_TIMEOUT);
+        std::string request = "count";
+        request += '\0';
+        request += mode_name(newline);
+        request += '\0';
+        request += absolute;
+        request += '\0';
+        if (!send_all(sock->fd(), request) || ::shutdown(sock->fd(), SHUT_WR) != 0) { return false; }
+        std::string answer;
+        if (!recv_all(sock->fd(), answer, 64)) { return false; }
+        unsigned long long value = 0;
+        char newline_char = 0;
+        if (std::sscanf(answer.c_str(), "ok %llu%c", &value, &newline_char) == 2 && newline_char == '\n')
+        {
+            reply.lines = static_cast<size_t>(value);
+            reply.error = 0;
+            return true;
+        }
+        if (std::sscanf(answer.c_str(), "error %llu%c", &value, &newline_char) == 2 && newline_char == '\n' && value)
+        {
+            reply.error = static_cast<int>(value);
+            return true;
+        }
+    }
+    catch (std::system_error const & )
+    {
+        // No daemon there.
+    }
+    return false;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * Daemon mode: answer line counts over a Unix socket from a shared cache.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace countline
+{
+
+struct DaemonOptions
+{
+    /// Threads counting a file the cache cannot answer; 0 picks from the size.
+    unsigned nthread = 0;
+    /// What reading such a file does to the page cache.
+    PageCache page_cache = PageCache::keep;
+    /// Fault the whole mapping in at once (MAP_POPULATE).
+    bool populate = false;
+    /// Ask for huge pages on the mapping (MADV_HUGEPAGE).
+    bool hugepage = false;
+    /// Most files remembered; the least recently asked half goes beyond it.
+    size_t max_entries = 65536;
+}; /* end struct DaemonOptions */
+
+/// $COUNTLINE_SOCKET, else $XDG_RUNTIME_DIR/countline.sock, else
+/// /tmp/countline-UID.sock.
+std::string default_socket_path();
+
+/**
+ * Serve count requests on the Unix socket at socket_path until SIGINT or
+ * SIGTERM.
+ *
+ * Each connection carries one request and is served on its own thread.  A
+ * count is remembered with the device, inode, size, modification and change
+ * times the file had before it was read, and a later request whose stat()
+ * still matches is answered without reading the file.  Requests for a file
+ * that is being counted wait for that count instead of starting another.
+ * Throws std::system_error when the socket cannot be set up.
+ */
+void run_daemon(std::string const & socket_path, DaemonOptions const & options);
+
+/// Outcome of a count made by the daemon.
+struct DaemonReply
+{
+    size_t lines = 0;
+    /// errno of the failure, or 0 when lines is valid.
+    int error = 0;
+}; /* end struct DaemonReply */
+
+/**
+ * Ask the daemon listening at socket_path for the lines of the file at path
+ * (made absolute first).  Returns false when no daemon answers properly, in
+ * which case the caller counts by itself.
+ */
+bool query_daemon(std::string const & socket_path, std::string const & path, Newline newline, DaemonReply & reply);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
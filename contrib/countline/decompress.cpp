@@ -0,0 +1,404 @@
+#include "decompress.hpp"
+#include "fileio.hpp"
+
+#include <lzma.h>
+#include <zlib.h>
+#ifdef COUNTLINE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+constexpr size_t OUTPUT_SIZE = 256 << 10;
+
+// The most zlib takes in one call; a test build lowers it to run the
+// slicing on small input.
+#ifndef COUNTLINE_ZLIB_SLICE
+#define COUNTLINE_ZLIB_SLICE UINT_MAX
+#endif
+constexpr size_t ZLIB_SLICE = COUNTLINE_ZLIB_SLICE;
+
+[[noreturn]] void throw_corrupt(char const * format, char const * detail)
+{
+    throw std::system_error(EBADMSG, std::generic_category(), std::string(format) + ": " + detail);
+}
+
+class GzipDecoder : public Decoder
+{
+public:
+    GzipDecoder()
+      : m_output(new unsigned char[OUTPUT_SIZE])
+    {
+        std::memset(&m_stream, 0, sizeof(m_stream));
+        // 16 + MAX_WBITS: expect a gzip header and trailer.
+        if (inflateInit2(&m_stream, 16 + MAX_WBITS) != Z_OK) { throw std::bad_alloc(); }
+    }
+    ~GzipDecoder() override { inflateEnd(&m_stream); }
+
+    void update(char const * data, size_t size, LineCounter & counter) override
+    {
+        // avail_in is an unsigned int: feed a larger input in slices.
+        while (size > 0 && !m_trailing)
+        {
+            size_t const slice = std::min<size_t>(size, ZLIB_SLICE);
+            m_stream.next_in = reinterpret_cast<unsigned char *>(const_cast<char *>(data));
+            m_stream.avail_in = static_cast<unsigned>(slice);
+            inflate_pending(counter);
+            data += slice;
+            size -= slice;
+        }
+    }
+
+    void finish(LineCounter & ) override
+    {
+        if (!m_member_ended) { throw_corrupt("gzip", "unexpected end of input"); }
+    }
+
+    void reset() override
+    {
+        inflateReset(&m_stream);
+        m_member_ended = false;
+        m_trailing = false;
+    }
+
+private:
+
+    /// Inflate the input set in m_stream until it is used up.
+    void inflate_pending(LineCounter & counter)
+    {
+        while (!m_trailing)
+        {
+            if (m_member_ended)
+            {
+                if (m_stream.avail_in == 0) { return; }
+                // Another member follows, unless it is padding that gzip(1)
+                // would ignore as trailing garbage.
+                if (m_stream.next_in[0] != 0x1f) { m_trailing = true; return; }
+                inflateReset(&m_stream);
+                m_member_ended = false;
+            }
+            m_stream.next_out = m_output.get();
+            m_stream.avail_out = OUTPUT_SIZE;
+            int const ret = inflate(&m_stream, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            {
+                throw_corrupt("gzip", m_stream.msg ? m_stream.msg : "invalid data");
+            }
+            size_t const produced = OUTPUT_SIZE - m_stream.avail_out;
+            counter.update(reinterpret_cast<char const *>(m_output.get()), produced);
+            if (ret == Z_STREAM_END) { m_member_ended = true; continue; }
+            // A full output buffer may leave more output pending; otherwise
+            // wait for more input.
+            if (m_stream.avail_out != 0 && m_stream.avail_in == 0) { return; }
+            if (ret == Z_BUF_ERROR && produced == 0) { return; }
+        }
+    }
+
+    z_stream m_stream;
+    std::unique_ptr<unsigned char[]> m_output;
+    bool m_member_ended = false;
+    bool m_trailing = false;
+}; /* end class GzipDecoder */
+
+class XzDecoder : public Decoder
+{
+public:
+    XzDecoder()
+      : m_output(new unsigned char[OUTPUT_SIZE])
+    {
+        init();
+    }
+    ~XzDecoder() override { lzma_end(&m_stream); }
+
+    void update(char const * data, size_t size, LineCounter & counter) override
+    {
+        m_stream.next_in = reinterpret_cast<uint8_t const *>(data);
+        m_stream.avail_in = size;
+        code(LZMA_RUN, counter);
+    }
+
+    void finish(LineCounter & counter) override
+    {
+        if (!code(LZMA_FINISH, counter)) { throw_corrupt("xz", "unexpected end of input"); }
+    }
+
+    void reset() override
+    {
+        lzma_end(&m_stream);
+        init();
+    }
+
+private:
+
+    void init()
+    {
+        m_stream = LZMA_STREAM_INIT;
+        if (lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    /// Run the decoder over the pending input; true once the stream ended.
+    bool code(lzma_action action, LineCounter & counter)
+    {
+        for (;;)
+        {
+            m_stream.next_out = m_output.get();
+            m_stream.avail_out = OUTPUT_SIZE;
+            lzma_ret const ret = lzma_code(&m_stream, action);
+            size_t const produced = OUTPUT_SIZE - m_stream.avail_out;
+            counter.update(reinterpret_cast<char const *>(m_output.get()), produced);
+            if (ret == LZMA_STREAM_END) { return true; }
+            if (ret == LZMA_BUF_ERROR && action == LZMA_FINISH) { return false; }
+            if (ret != LZMA_OK) { throw_corrupt("xz", "invalid data"); }
+            if (m_stream.avail_in == 0 && produced < OUTPUT_SIZE && action == LZMA_RUN) { return false; }
+        }
+    }
+
+    lzma_stream m_stream;
+    std::unique_ptr<unsigned char[]> m_output;
+}; /* end class XzDecoder */
+
+#ifdef COUNTLINE_HAVE_ZSTD
+
+class ZstdDecoder : public Decoder
+{
+public:
+    ZstdDecoder()
+      : m_context(ZSTD_createDCtx()), m_output(new char[OUTPUT_SIZE])
+    {
+        if (!m_context) { throw std::bad_alloc(); }
+    }
+    ~ZstdDecoder() override { ZSTD_freeDCtx(m_context); }
+
+    void update(char const * data, size_t size, LineCounter & counter) override
+    {
+        ZSTD_inBuffer input = {data, size, 0};
+        for (;;)
+        {
+            ZSTD_outBuffer output = {m_output.get(), OUTPUT_SIZE, 0};
+            size_t const ret = ZSTD_decompressStream(m_context, &output, &input);
+            if (ZSTD_isError(ret)) { throw_corrupt("zstd", ZSTD_getErrorName(ret)); }
+            counter.update(m_output.get(), output.pos);
+            m_frame_ended = (ret == 0);
+            // Done when the input is consumed and the output was not full,
+            // i.e. nothing is left buffered inside the context.
+            if (input.pos == input.size && output.pos < output.size) { break; }
+        }
+    }
+
+    void finish(LineCounter & ) override
+    {
+        if (!m_frame_ended) { throw_corrupt("zstd", "unexpected end of input"); }
+    }
+
+    void reset() override
+    {
+        ZSTD_DCtx_reset(m_context, ZSTD_reset_session_only);
+        m_frame_ended = true;
+    }
+
+private:
+    ZSTD_DCtx * m_context;
+    std::unique_ptr<char[]> m_output;
+    bool m_frame_ended = true;
+}; /* end class ZstdDecoder */
+
+#endif // COUNTLINE_HAVE_ZSTD
+
+/// [offset, offset+size) of an independently decodable piece of the input.
+using Frame = std::pair<size_t, size_t>;
+
+/**
+ * Locate the members of a BGZF-style gzip file, whose "BC" extra subfield
+ * records the size of each member.  Empty if any member lacks it.
+ */
+std::vector<Frame> find_bgzf_members(unsigned char const * data, size_t size)
+{
+    std::vector<Frame> members;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        unsigned char const * head = data + offset;
+        size_t const left = size - offset;
+        // ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2)
+        if (left < 12 || head[0] != 0x1f || head[1] != 0x8b || head[2] != 8 || !(head[3] & 0x04))
+        {
+            return {};
+        }
+        size_t const xlen = head[10] | (head[11] << 8);
+        if (left < 12 + xlen) { return {}; }
+        size_t bsize = 0;
+        for (size_t it=12; it+4<=12+xlen; )
+        {
+            size_t const slen = head[it+2] | (head[it+3] << 8);
+            if (head[it] == 'B' && head[it+1] == 'C' && slen == 2 && it+6 <= 12+xlen)
+            {
+                bsize = (head[it+4] | (head[it+5] << 8)) + 1;
+                break;
+            }
+            it += 4 + slen;
+        }
+        if (bsize == 0 || bsize > left) { return {}; }
+        members.emplace_back(offset, bsize);
+        offset += bsize;
+    }
+    return members;
+}
+
+#ifdef COUNTLINE_HAVE_ZSTD
+/// Locate the frames of a zstd file from their headers.  Empty on error.
+std::vector<Frame> find_zstd_frames(unsigned char const * data, size_t size)
+{
+    std::vector<Frame> frames;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        size_t const length = ZSTD_findFrameCompressedSize(data + offset, size - offset);
+        if (ZSTD_isError(length)) { return {}; }
+        frames.emplace_back(offset, length);
+        offset += length;
+    }
+    return frames;
+}
+#endif // COUNTLINE_HAVE_ZSTD
+
+/// Decode frames with nthread workers and merge their counts in order.
+size_t count_frames(char const * data, std::vector<Frame> const & frames, Compression compression, unsigned nthread, Newline newline)
+{
+    std::vector<LineCounter> counters(frames.size(), LineCounter(newline));
+    std::atomic<size_t> next_frame(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]()
+    {
+        try
+        {
+            std::unique_ptr<Decoder> decoder = Decoder::create(compression);
+            for (;;)
+            {
+                size_t const iframe = next_frame.fetch_add(1, std::memory_order_relaxed);
+                if (iframe >= frames.size()) { break; }
+                decoder->reset();
+                decoder->update(data + frames[iframe].first, frames[iframe].second, counters[iframe]);
+                decoder->finish(counters[iframe]);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) { error = std::current_exception(); }
+            next_frame.store(frames.size(), std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned it=1; it<nthread; ++it)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    if (error) { std::rethrow_exception(error); }
+
+    LineCounter total(newline);
+    for (LineCounter const & counter : counters)
+    {
+        total.append(counter);
+    }
+    return total.lines();
+}
+
+} /* end namespace */
+
+Compression detect_compression(void const * head, size_t size)
+{
+    unsigned char const * magic = static_cast<unsigned char const *>(head);
+    if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return Compression::gzip;
+    }
+    if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+        return Compression::zstd;
+    }
+    if (size >= 6 && std::memcmp(magic, "\xfd" "7zXZ\0", 6) == 0)
+    {
+        return Compression::xz;
+    }
+    return Compression::none;
+}
+
+char const * compression_name(Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::gzip: return "gzip";
+    case Compression::zstd: return "zstd";
+    case Compression::xz: return "xz";
+    default: return "none";
+    }
+}
+
+std::unique_ptr<Decoder> Decoder::create(Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::gzip:
+        return std::unique_ptr<Decoder>(new GzipDecoder());
+    case Compression::xz:
+        return std::unique_ptr<Decoder>(new XzDecoder());
+#ifdef COUNTLINE_HAVE_ZSTD
+    case Compression::zstd:
+        return std::unique_ptr<Decoder>(new ZstdDecoder());
+#endif
+    default:
+        throw std::system_error(ENOTSUP, std::generic_category(), compression_name(compression));
+    }
+}
+
+size_t count_compressed_file(int fd, size_t size, Compression compression, unsigned nthread, Newline newline)
+{
+    Mapping const mapping(fd, size);
+    if (!mapping) { throw_errno("mmap"); }
+    unsigned char const * data = reinterpret_cast<unsigned char const *>(mapping.data());
+
+    std::vector<Frame> frames;
+    if (nthread > 1)
+    {
+        if (compression == Compression::gzip) { frames = find_bgzf_members(data, size); }
+#ifdef COUNTLINE_HAVE_ZSTD
+        if (compression == Compression::zstd) { frames = find_zstd_frames(data, size); }
+#endif
+    }
+    if (frames.size() < 2)
+    {
+        frames.assign(1, Frame(0, size));
+        nthread = 1;
+    }
+    nthread = static_cast<unsigned>(std::min<size_t>(nthread, frames.size()));
+    return count_frames(mapping.data(), frames, compression, nthread, newline);
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Counting the decompressed content of gzip, zstd and xz input.
+ *
+ * gzip is decoded with zlib and xz with liblzma.  zstd support is compiled in
+ * when the build finds libzstd (COUNTLINE_HAVE_ZSTD).
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <memory>
+
+namespace countline
+{
+
+enum class Compression
+{
+    none,
+    gzip,
+    zstd,
+    xz,
+}; /* end enum class Compression */
+
+/// Size of the prefix detect_compression() needs to recognize every format.
+constexpr size_t MAGIC_SIZE = 6;
+
+/// Recognize the format from the magic bytes at the start of the input.
+Compression detect_compression(void const * head, size_t size);
+
+char const * compression_name(Compression compression);
+
+/**
+ * Streaming decoder that feeds the decompressed bytes to a LineCounter.
+ *
+ * Concatenated gzip members, zstd frames and xz streams are decoded one
+ * after the other.  Corrupt input throws std::system_error with EBADMSG, and
+ * a format not compiled in throws it with ENOTSUP.
+ */
+class Decoder
+{
+public:
+    static std::unique_ptr<Decoder> create(Compression compression);
+
+    virtual ~Decoder() = default;
+
+    /// Decode the next piece of the compressed input.
+    virtual void update(char const * data, size_t size, LineCounter & counter) = 0;
+    /// Check that the input ended at the end of a member, frame or stream.
+    virtual void finish(LineCounter & counter) = 0;
+    /// Prepare for decoding an unrelated input.
+    virtual void reset() = 0;
+}; /* end class Decoder */
+
+/**
+ * Count the lines in the decompressed content of a regular file.
+ *
+ * zstd frames and BGZF-style gzip members (which record their compressed
+ * size in the header) are located without decoding and decoded by up to
+ * nthread threads; any other input is decoded sequentially.
+ */
+size_t count_compressed_file(int fd, size_t size, Compression compression, unsigned nthread, Newline newline);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
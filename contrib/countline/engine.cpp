@@ -0,0 +1,368 @@
+#include "countline.hpp"
+#include "decompress.hpp"
+#include "fileio.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+constexpr size_t PIPE_SIZE = 1 << 20;
+constexpr size_t CHUNK_SIZE = 4 << 20;
+constexpr size_t BYTES_PER_THREAD = 32 << 20;
+constexpr size_t DIRECT_ALIGN = 4096;
+
+size_t page_size()
+{
+    static size_t const size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+/**
+ * Whether each page of the first size bytes of fd is in the page cache, asked
+ * with mincore() on a mapping that is never touched: one byte per page.  When
+ * it cannot be told, every page counts as cached.
+ */
+std::vector<unsigned char> resident_pages(int fd, size_t size)
+{
+    std::vector<unsigned char> resident((size + page_size() - 1) / page_size(), 1);
+    void * addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) { return resident; }
+    if (::mincore(addr, size, resident.data()) != 0)
+    {
+        std::fill(resident.begin(), resident.end(), 1);
+    }
+    ::munmap(addr, size);
+    return resident;
+}
+
+/// Evict the pages of [offset, offset+length) that resident says were not cached.
+void drop_pages(int fd, size_t offset, size_t length, std::vector<unsigned char> const & resident)
+{
+    size_t const page = page_size();
+    size_t const last = std::min(resident.size(), (offset + length + page - 1) / page);
+    for (size_t begin=offset/page; begin<last; )
+    {
+        if (resident[begin] & 1) { ++begin; continue; }
+        size_t end = begin + 1;
+        while (end < last && !(resident[end] & 1)) { ++end; }
+        ::posix_fadvise(fd, static_cast<off_t>(begin * page), static_cast<off_t>((end - begin) * page), POSIX_FADV_DONTNEED);
+        begin = end;
+    }
+}
+
+/**
+ * Count the lines of the first size bytes of a regular file with nthread
+ * workers, each claiming CHUNK_SIZE-aligned chunks in turn.  With drop, the
+ * pages each chunk brings into the page cache are evicted once counted.  Which
+ * pages were cached is noted before the first read, since readahead brings in
+ * the next chunk before its turn.
+ */
+size_t count_chunked(int fd, size_t size, unsigned nthread, Newline newline, bool drop)
+{
+    std::vector<unsigned char> resident;
+    if (drop)
+    {
+        resident = resident_pages(fd, size);
+        ::posix_fadvise(fd, 0, static_cast<off_t>(size), POSIX_FADV_SEQUENTIAL);
+    }
+    size_t const nchunk = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<size_t> newlines(0);
+    // The edge bytes of each chunk, to join a "\r\n" split between two.
+    std::vector<char> firsts(nchunk, '\0');
+    std::vector<char> lasts(nchunk, '\n');
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]()
+    {
+        try
+        {
+            std::unique_ptr<char[]> buffer(new char[CHUNK_SIZE]);
+            size_t local = 0;
+            for (;;)
+            {
+                size_t const ichunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+                if (ichunk >= nchunk) { break; }
+                size_t const offset = ichunk * CHUNK_SIZE;
+                size_t const length = std::min(CHUNK_SIZE, size - offset);
+                size_t const nread = pread_full(fd, buffer.get(), length, static_cast<off_t>(offset));
+                if (drop) { drop_pages(fd, offset, length, resident); }
+                local += count_line_ends(buffer.get(), nread, newline);
+                if (nread)
+                {
+                    firsts[ichunk] = buffer[0];
+                    lasts[ichunk] = buffer[nread - 1];
+                }
+            }
+            newlines.fetch_add(local, std::memory_order_relaxed);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) { error = std::current_exception(); }
+            next_chunk.store(nchunk, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned it=1; it<nthread; ++it)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    if (error) { std::rethrow_exception(error); }
+
+    size_t total = newlines.load();
+    if (newline == Newline::universal)
+    {
+        for (size_t ichunk=1; ichunk<nchunk; ++ichunk)
+        {
+            if (lasts[ichunk - 1] == '\r' && firsts[ichunk] == '\n') { --total; }
+        }
+    }
+    return total + (is_line_end(lasts[nchunk - 1], newline) ? 0 : 1);
+}
+
+/// Read up to size bytes at an aligned offset of an O_DIRECT descriptor.
+size_t pread_direct(int fd, char * buffer, size_t size, size_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t const nread = ::pread(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+        if (nread < 0)
+        {
+            if (errno == EINTR) { continue; }
+            throw_errno("pread");
+        }
+        done += static_cast<size_t>(nread);
+        // Only the end of the file leaves the next offset unaligned.
+        if (nread == 0 || done % DIRECT_ALIGN) { break; }
+    }
+    return done;
+}
+
+/**
+ * Count the first size bytes of the regular file on fd with O_DIRECT reads
+ * into two aligned buffers: the next chunk is read while the current one is
+ * counted.  Falls back to dropping pages when the file system refuses
+ * O_DIRECT.
+ */
+size_t count_direct(int fd, size_t size, Newline newline)
+{
+    std::unique_ptr<File> direct;
+    try
+    {
+        direct.reset(new File("/proc/self/fd/" + std::to_string(fd), O_DIRECT));
+    }
+    catch (std::system_error const & )
+    {
+        return count_chunked(fd, size, 1, newline, true);
+    }
+
+    using Buffer = std::unique_ptr<char, decltype(&std::free)>;
+    Buffer buffers[2] = {
+        Buffer(static_cast<char *>(std::aligned_alloc(DIRECT_ALIGN, CHUNK_SIZE)), &std::free),
+        Buffer(static_cast<char *>(std::aligned_alloc(DIRECT_ALIGN, CHUNK_SIZE)), &std::free),
+    };
+    if (!buffers[0] || !buffers[1]) { throw std::bad_alloc(); }
+    int const dfd = direct->fd();
+    auto read_chunk = [&](size_t ichunk)
+    {
+        return std::async(std::launch::async, pread_direct, dfd, buffers[ichunk % 2].get(), CHUNK_SIZE, ichunk * CHUNK_SIZE);
+    };
+
+    size_t const nchunk = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    LineCounter counter(newline);
+    std::future<size_t> pending = read_chunk(0);
+    for (size_t ichunk=0; ichunk<nchunk; ++ichunk)
+    {
+        size_t nread;
+        try
+        {
+            nread = pending.get();
+        }
+        catch (std::system_error const & e)
+        {
+            if (ichunk == 0 && e.code().value() == EINVAL) { return count_chunked(fd, size, 1, newline, true); }
+            throw;
+        }
+        nread = std::min(nread, size - ichunk * CHUNK_SIZE);
+        if (ichunk + 1 < nchunk) { pending = read_chunk(ichunk + 1); }
+        counter.update(buffers[ichunk % 2].get(), nread);
+    }
+    return counter.lines();
+}
+
+} /* end namespace */
+
+unsigned auto_thread_count(size_t size)
+{
+    unsigned const nhard = std::max(1U, std::thread::hardware_concurrency());
+    size_t const nwanted = std::max<size_t>(1, size / BYTES_PER_THREAD);
+    return static_cast<unsigned>(std::min<size_t>(nhard, nwanted));
+}
+
+void LineCounter::update(char const * data, size_t size)
+{
+    if (size == 0) { return; }
+    m_newlines += count_line_ends(data, size, m_newline);
+    // The "\r" ending the previous piece was counted; so was its "\n".
+    if (m_newline == Newline::universal && m_bytes && m_last == '\r' && data[0] == '\n') { --m_newlines; }
+    if (m_bytes == 0) { m_first = data[0]; }
+    m_bytes += size;
+    m_last = data[size - 1];
+}
+
+void LineCounter::append(LineCounter const & other)
+{
+    if (other.m_bytes == 0) { return; }
+    m_newlines += other.m_newlines;
+    if (m_newline == Newline::universal && m_bytes && m_last == '\r' && other.m_first == '\n') { --m_newlines; }
+    if (m_bytes == 0) { m_first = other.m_first; }
+    m_bytes += other.m_bytes;
+    m_last = other.m_last;
+}
+
+size_t count_fd(int fd, Options const & options)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+
+    // A regular file read partly already is counted from where it was left,
+    // as a pipe would be.
+    if (S_ISREG(st.st_mode) && st.st_size > 0 && ::lseek(fd, 0, SEEK_CUR) <= 0)
+    {
+        size_t const size = static_cast<size_t>(st.st_size);
+        if (options.decompress)
+        {
+            unsigned char magic[MAGIC_SIZE];
+            size_t const nmagic = pread_full(fd, reinterpret_cast<char *>(magic), MAGIC_SIZE, 0);
+            Compression const compression = detect_compression(magic, nmagic);
+            if (compression != Compression::none)
+            {
+                // Decoding is CPU-bound; use every hardware thread by default.
+                unsigned const nthread = options.nthread ? options.nthread : std::max(1U, std::thread::hardware_concurrency());
+                return count_compressed_file(fd, size, compression, nthread, options.newline);
+            }
+        }
+        return count_regular(fd, size, options);
+    }
+
+    return count_stream(fd, options);
+}
+
+size_t count_regular(int fd, size_t size, Options const & options)
+{
+    if (size == 0) { return 0; }
+    if (options.page_cache == PageCache::direct)
+    {
+        return count_direct(fd, size, options.newline);
+    }
+    unsigned nthread = options.nthread ? options.nthread : auto_thread_count(size);
+    if (!options.nthread && options.max_thread) { nthread = std::min(nthread, options.max_thread); }
+    nthread = static_cast<unsigned>(std::min<size_t>(nthread, (size + CHUNK_SIZE - 1) / CHUNK_SIZE));
+    if (nthread > 1 || options.page_cache == PageCache::drop)
+    {
+        return count_chunked(fd, size, nthread, options.newline, options.page_cache == PageCache::drop);
+    }
+    Mapping const mapping(fd, size, options.populate, options.hugepage);
+    if (mapping)
+    {
+        LineCounter counter(options.newline);
+        counter.update(mapping.data(), mapping.size());
+        return counter.lines();
+    }
+    return count_chunked(fd, size, 1, options.newline, false);
+}
+
+size_t count_stream(int fd, Options const & options)
+{
+    struct stat st;
+    if (::fstat(fd, &st) == 0)
+    {
+        if (S_ISFIFO(st.st_mode))
+        {
+            // Best effort: the limit for unprivileged users may be lower.
+            ::fcntl(fd, F_SETPIPE_SZ, static_cast<int>(PIPE_SIZE));
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    std::unique_ptr<char, decltype(&std::free)> buffer(
+        static_cast<char *>(std::aligned_alloc(4096, STREAM_BUFFER_SIZE)), &std::free);
+    if (!buffer) { throw std::bad_alloc(); }
+    LineCounter counter(options.newline);
+    std::unique_ptr<Decoder> decoder;
+    bool detected = !options.decompress;
+    size_t pending = 0; // bytes kept until the magic can be recognized
+    for (;;)
+    {
+        ssize_t const nread = ::read(fd, buffer.get() + pending, STREAM_BUFFER_SIZE - pending);
+        if (nread < 0)
+        {
+            if (errno == EINTR) { continue; }
+            throw_errno("read");
+        }
+        size_t const size = pending + static_cast<size_t>(nread);
+        if (!detected)
+        {
+            if (nread > 0 && size < MAGIC_SIZE) { pending = size; continue; }
+            Compression const compression = detect_compression(buffer.get(), size);
+            if (compression != Compression::none) { decoder = Decoder::create(compression); }
+            detected = true;
+        }
+        pending = 0;
+        if (size == 0) { break; }
+        if (decoder) { decoder->update(buffer.get(), size, counter); }
+        else { counter.update(buffer.get(), size); }
+        if (nread == 0) { break; }
+    }
+    if (decoder) { decoder->finish(counter); }
+    return counter.lines();
+}
+
+size_t count_file(std::string const & path, Options const & options)
+{
+    File const file(path);
+    try
+    {
+        return count_fd(file.fd(), options);
+    }
+    catch (std::system_error const & e)
+    {
+        throw std::system_error(e.code(), path);
+    }
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,93 @@
+#include "estimate.hpp"
+#include "fileio.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+/// Two-sided 95% quantile of the normal distribution.
+constexpr double Z95 = 1.959963984540054;
+
+Estimate exact(size_t lines)
+{
+    Estimate estimate;
+    estimate.lines = estimate.low = estimate.high = lines;
+    estimate.exact = true;
+    return estimate;
+}
+
+} /* end namespace */
+
+Estimate estimate_lines(int fd, EstimateOptions const & options)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+    size_t const nblock = std::max(1U, options.nblock);
+    size_t const block_size = std::max<size_t>(4096, options.block_size);
+    size_t const size = static_cast<size_t>(st.st_size);
+    if (!S_ISREG(st.st_mode) || size <= nblock * block_size)
+    {
+        Options count_options;
+        count_options.newline = options.newline;
+        return exact(count_fd(fd, count_options));
+    }
+
+    std::mt19937_64 rng(options.seed ? options.seed : (uint64_t(std::random_device()()) << 32 | std::random_device()()));
+    size_t const stratum = size / nblock;
+    std::vector<size_t> offsets(nblock);
+    for (size_t it=0; it<nblock; ++it)
+    {
+        // One byte before the block tells whether a leading "\n" ends a "\r\n".
+        size_t const span = std::min(stratum, size - it * stratum) - block_size;
+        offsets[it] = std::max<size_t>(1, it * stratum + rng() % (span + 1));
+        ::posix_fadvise(fd, static_cast<off_t>(offsets[it] - 1), static_cast<off_t>(block_size + 1), POSIX_FADV_WILLNEED);
+    }
+
+    std::unique_ptr<char[]> buffer(new char[block_size + 1]);
+    double sum = 0;
+    double sum2 = 0;
+    for (size_t const offset : offsets)
+    {
+        size_t const nread = pread_full(fd, buffer.get(), block_size + 1, static_cast<off_t>(offset - 1));
+        if (nread < 2) { throw std::system_error(EIO, std::generic_category(), "file shrank while sampled"); }
+        double count = static_cast<double>(count_line_ends(buffer.get() + 1, nread - 1, options.newline));
+        if (options.newline == Newline::universal && buffer[0] == '\r' && buffer[1] == '\n') { count -= 1; }
+        double const density = count / static_cast<double>(nread - 1);
+        sum += density;
+        sum2 += density * density;
+    }
+
+    double const n = static_cast<double>(nblock);
+    double const mean = sum / n;
+    double const variance = nblock > 1 ? std::max(0.0, (sum2 - n * mean * mean) / (n - 1)) : mean * mean;
+    // Finite-population correction: the sample covers part of the file.
+    double const coverage = n * static_cast<double>(block_size) / static_cast<double>(size);
+    double const error = Z95 * std::sqrt(variance / n * (1 - coverage)) * static_cast<double>(size);
+    double const total = mean * static_cast<double>(size);
+
+    char last = '\n';
+    pread_full(fd, &last, 1, static_cast<off_t>(size - 1));
+    size_t const partial = is_line_end(last, options.newline) ? 0 : 1;
+
+    Estimate estimate;
+    estimate.lines = static_cast<size_t>(std::llround(total)) + partial;
+    estimate.low = static_cast<size_t>(std::llround(std::max(0.0, total - error))) + partial;
+    estimate.high = static_cast<size_t>(std::llround(total + error)) + partial;
+    estimate.nblock = static_cast<unsigned>(nblock);
+    return estimate;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * Line-count estimates from random samples of a file.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace countline
+{
+
+struct EstimateOptions
+{
+    /// Number of blocks to sample.
+    unsigned nblock = 64;
+    /// Bytes in each block.
+    size_t block_size = 64 << 10;
+    /// What ends a line.
+    Newline newline = Newline::universal;
+    /// Seed of the block offsets; 0 draws one from std::random_device.
+    uint64_t seed = 0;
+}; /* end struct EstimateOptions */
+
+struct Estimate
+{
+    size_t lines = 0;
+    /// Bounds of the 95% confidence interval; both equal lines when exact.
+    size_t low = 0;
+    size_t high = 0;
+    /// Whether the whole file was counted.
+    bool exact = false;
+    /// Number of blocks sampled (0 when exact).
+    unsigned nblock = 0;
+}; /* end struct Estimate */
+
+/**
+ * Estimate the lines of the regular file on fd from a sample of blocks.
+ *
+ * The file is cut into nblock equal strata and one block is read at a random
+ * offset in each, so the whole file is covered however its line lengths
+ * drift.  All reads are announced with POSIX_FADV_WILLNEED before the first
+ * is waited for, letting the device serve them concurrently; the time taken
+ * depends on nblock and block_size, not on the size of the file.  The line
+ * density of the blocks extrapolates to the file size, with a normal 95%
+ * interval from their spread.  A file no larger than the sample, or one that
+ * is not a regular file, is counted exactly instead.  Throws
+ * std::system_error on failure.
+ */
+Estimate estimate_lines(int fd, EstimateOptions const & options = EstimateOptions());
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
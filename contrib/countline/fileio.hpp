@@ -0,0 +1,114 @@
+#pragma once
+
+/*
+ * RAII helpers for the POSIX file I/O shared by the countline modules.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+
+namespace countline
+{
+
+[[noreturn]] inline void throw_errno(std::string const & what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/// Owns a file descriptor.
+class File
+{
+public:
+    /// Open path read-only, with extra open() flags such as O_DIRECT.
+    explicit File(std::string const & path, int flags = 0)
+      : m_fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC | flags))
+    {
+        if (m_fd < 0) { throw_errno(path); }
+    }
+    File(File const & ) = delete;
+    File & operator=(File const & ) = delete;
+    ~File() { ::close(m_fd); }
+    int fd() const { return m_fd; }
+private:
+    int m_fd;
+}; /* end class File */
+
+/// Owns a descriptor made by something other than open(): a socket, an
+/// inotify instance, a signalfd.
+class Descriptor
+{
+public:
+    Descriptor(int fd, char const * what) : m_fd(fd)
+    {
+        if (m_fd < 0) { throw_errno(what); }
+    }
+    Descriptor(Descriptor const & ) = delete;
+    Descriptor & operator=(Descriptor const & ) = delete;
+    ~Descriptor() { ::close(m_fd); }
+    int fd() const { return m_fd; }
+private:
+    int m_fd;
+}; /* end class Descriptor */
+
+/// Owns a read-only private mapping of a whole file.
+class Mapping
+{
+public:
+    /**
+     * With populate the whole file is read in (MAP_POPULATE) before the
+     * constructor returns; with hugepage the kernel is asked to back the
+     * mapping with huge pages (MADV_HUGEPAGE, honoured only by file systems
+     * and kernels that support it).
+     */
+    Mapping(int fd, size_t size, bool populate = false, bool hugepage = false)
+      : m_size(size)
+    {
+        void * addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        m_data = (addr == MAP_FAILED) ? nullptr : static_cast<char const *>(addr);
+        if (m_data)
+        {
+            ::madvise(addr, size, MADV_SEQUENTIAL);
+            if (hugepage) { ::madvise(addr, size, MADV_HUGEPAGE); }
+        }
+    }
+    Mapping(Mapping const & ) = delete;
+    Mapping & operator=(Mapping const & ) = delete;
+    ~Mapping()
+    {
+        if (m_data) { ::munmap(const_cast<char *>(m_data), m_size); }
+    }
+    explicit operator bool() const { return m_data != nullptr; }
+    char const * data() const { return m_data; }
+    size_t size() const { return m_size; }
+private:
+    char const * m_data;
+    size_t m_size;
+}; /* end class Mapping */
+
+/// Read exactly size bytes at offset unless the file ends first.
+inline size_t pread_full(int fd, char * buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t const nread = ::pread(fd, buffer + done, size - done, offset + done);
+        if (nread < 0)
+        {
+            if (errno == EINTR) { continue; }
+            throw_errno("pread");
+        }
+        if (nread == 0) { break; }
+        done += static_cast<size_t>(nread);
+    }
+    return done;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
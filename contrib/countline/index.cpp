@@ -0,0 +1,382 @@
+#include "index.hpp"
+#include "countline.hpp"
+#include "fileio.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace countline
+{
+
+namespace
+{
+
+constexpr char INDEX_MAGIC[8] = {'C', 'L', 'I', 'D', 'X', '\0', '\0', '\2'};
+constexpr size_t FEED_SIZE = 1 << 20;
+constexpr size_t LOCATE_SIZE = 4 << 10;
+constexpr size_t READ_SIZE = 64 << 10;
+
+int64_t mtime_of(struct stat const & st)
+{
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/**
+ * Walks over line ends in buffers read one after another.
+ *
+ * In universal mode a "\r" ends a line; the "\n" that follows it belongs
+ * to the same line end, even when it starts the next buffer.
+ */
+class LineSkipper
+{
+public:
+    explicit LineSkipper(Newline newline) : m_newline(newline) {}
+
+    /// Advance past up to count line ends in [it, end), decrementing count.
+    char const * skip(char const * it, char const * end, size_t & count)
+    {
+        if (m_after_cr && it < end && *it == '\n') { ++it; }
+        m_after_cr = false;
+        if (m_newline == Newline::lf)
+        {
+            for (; count && it < end; --count)
+            {
+                char const * newline = static_cast<char const *>(std::memchr(it, '\n', end - it));
+                if (!newline) { return end; }
+                it = newline + 1;
+            }
+            return it;
+        }
+        char const * cr = nullptr; // next "\r" at or after it, or end
+        char const * lf = nullptr; // next "\n" at or after it, or end
+        for (; count && it < end; --count)
+        {
+            if (!cr || cr < it) { cr = find(it, end, '\r'); }
+            if (!lf || lf < it) { lf = find(it, end, '\n'); }
+            if (cr == end && lf == end) { return end; }
+            it = std::min(cr, lf) + 1;
+            if (it[-1] == '\r')
+            {
+                if (it == end) { m_after_cr = true; }
+                else if (*it == '\n') { ++it; }
+            }
+        }
+        return it;
+    }
+
+    /// Whether the last line end was a "\r" at the end of a buffer, so that
+    /// a "\n" starting the next one still belongs to it.
+    bool after_cr() const { return m_after_cr; }
+
+private:
+
+    static char const * find(char const * it, char const * end, char c)
+    {
+        char const * found = static_cast<char const *>(std::memchr(it, c, end - it));
+        return found ? found : end;
+    }
+
+    Newline m_newline;
+    bool m_after_cr = false;
+}; /* end class LineSkipper */
+
+/**
+ * Feed the file in pieces; sample the start of every interval-th line.
+ *
+ * A piece without a sampled line end costs one count_line_ends() call.  The
+ * one that has it is counted again in LOCATE_SIZE blocks, and only the block
+ * holding the line end is searched for it.
+ */
+class IndexBuilder
+{
+public:
+    IndexBuilder(size_t interval, Newline newline)
+      : m_interval(interval), m_newline(newline), m_next(interval)
+    {
+        m_samples.push_back(0);
+    }
+
+    void update(char const * data, size_t size)
+    {
+        if (size == 0) { return; }
+        size_t begin = 0;
+        if (m_newline == Newline::universal && m_bytes && m_last == '\r' && data[0] == '\n')
+        {
+            // Completes the "\r" that ended the previous piece, which was
+            // already counted; a line sampled after it starts one byte later.
+            if (m_samples.back() == m_bytes) { ++m_samples.back(); }
+            begin = 1;
+        }
+        size_t const nline = count_line_ends(data + begin, size - begin, m_newline);
+        if (m_newlines + nline < m_next)
+        {
+            m_newlines += nline;
+        }
+        else
+        {
+            locate(data, begin, size);
+        }
+        m_bytes += size;
+        m_last = data[size - 1];
+    }
+
+    size_t newlines() const { return m_newlines; }
+    uint64_t bytes() const { return m_bytes; }
+    char last() const { return m_last; }
+    std::vector<uint64_t> & samples() { return m_samples; }
+
+private:
+
+    void locate(char const * data, size_t begin, size_t size)
+    {
+        char const * it = data + begin;
+        char const * const end = data + size;
+        while (it < end)
+        {
+            size_t const need = m_next - m_newlines;
+            size_t length = std::min<size_t>(LOCATE_SIZE, end - it);
+            // Keep a "\r\n" within one block so it is counted once.
+            if (it + length < end && it[length - 1] == '\r' && it[length] == '\n') { ++length; }
+            size_t const nline = count_line_ends(it, length, m_newline);
+            if (nline < need)
+            {
+                m_newlines += nline;
+                it += length;
+                continue;
+            }
+            size_t left = need;
+            LineSkipper skipper(m_newline);
+            it = skipper.skip(it, end, left);
+            m_newlines += need;
+            m_samples.push_back(m_bytes + static_cast<uint64_t>(it - data));
+            m_next += m_interval;
+        }
+    }
+
+    size_t m_interval;
+    Newline m_newline;
+    size_t m_next; // line-end count at which the next sample is due
+    size_t m_newlines = 0;
+    uint64_t m_bytes = 0;
+    char m_last = '\n';
+    std::vector<uint64_t> m_samples;
+}; /* end class IndexBuilder */
+
+void put_varint(std::string & out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// Decode a varint at it; false if the data ends or it is too long.
+bool get_varint(unsigned char const * & it, unsigned char const * end, uint64_t & value)
+{
+    value = 0;
+    for (unsigned shift=0; shift<64 && it<end; shift+=7)
+    {
+        unsigned char const byte = *it++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) { return true; }
+    }
+    return false;
+}
+
+[[noreturn]] void throw_corrupt(std::string const & path)
+{
+    throw std::system_error(EBADMSG, std::generic_category(), path);
+}
+
+} /* end namespace */
+
+std::string LineIndex::sidecar_path(std::string const & path)
+{
+    return path + ".clidx";
+}
+
+LineIndex LineIndex::build(int fd, size_t interval, Newline newline)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+    if (!S_ISREG(st.st_mode)) { throw std::system_error(ESPIPE, std::generic_category(), "index"); }
+
+    IndexBuilder builder(std::max<size_t>(1, interval), newline);
+    size_t const size = static_cast<size_t>(st.st_size);
+    Mapping const mapping(fd, size);
+    if (size && mapping)
+    {
+        for (size_t offset=0; offset<size; offset+=FEED_SIZE)
+        {
+            builder.update(mapping.data() + offset, std::min(FEED_SIZE, size - offset));
+        }
+    }
+    else if (size)
+    {
+        std::unique_ptr<char[]> buffer(new char[FEED_SIZE]);
+        for (size_t offset=0; offset<size; )
+        {
+            size_t const nread = pread_full(fd, buffer.get(), std::min(FEED_SIZE, size - offset), static_cast<off_t>(offset));
+            if (nread == 0) { break; }
+            builder.update(buffer.get(), nread);
+            offset += nread;
+        }
+    }
+
+    LineIndex index;
+    index.m_interval = std::max<size_t>(1, interval);
+    index.m_newline = newline;
+    index.m_size = builder.bytes();
+    index.m_mtime = mtime_of(st);
+    index.m_newlines = builder.newlines();
+    index.m_last = builder.last();
+    index.m_samples.swap(builder.samples());
+    return index;
+}
+
+LineIndex LineIndex::load(std::string const & path)
+{
+    std::string data;
+    {
+        File const file(path);
+        char buffer[READ_SIZE];
+        for (off_t offset=0; ; )
+        {
+            size_t const nread = pread_full(file.fd(), buffer, sizeof(buffer), offset);
+            data.append(buffer, nread);
+            if (nread < sizeof(buffer)) { break; }
+            offset += static_cast<off_t>(nread);
+        }
+    }
+
+    unsigned char const * it = reinterpret_cast<unsigned char const *>(data.data());
+    unsigned char const * const end = it + data.size();
+    if (data.size() < sizeof(INDEX_MAGIC) || std::memcmp(it, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+    {
+        throw_corrupt(path);
+    }
+    it += sizeof(INDEX_MAGIC);
+
+    LineIndex index;
+    uint64_t interval, newline, mtime, newlines, last, nsample;
+    if (!get_varint(it, end, interval) || !get_varint(it, end, newline) || !get_varint(it, end, index.m_size)
+        || !get_varint(it, end, mtime) || !get_varint(it, end, newlines)
+        || !get_varint(it, end, last) || !get_varint(it, end, nsample)
+        || interval == 0 || newline > 1 || nsample != newlines / interval + 1)
+    {
+        throw_corrupt(path);
+    }
+    index.m_interval = static_cast<size_t>(interval);
+    index.m_newline = newline ? Newline::lf : Newline::universal;
+    index.m_mtime = static_cast<int64_t>(mtime);
+    index.m_newlines = static_cast<size_t>(newlines);
+    index.m_last = static_cast<char>(last);
+    index.m_samples.reserve(static_cast<size_t>(nsample));
+    uint64_t offset = 0;
+    for (uint64_t isample=0; isample<nsample; ++isample)
+    {
+        uint64_t delta;
+        if (!get_varint(it, end, delta)) { throw_corrupt(path); }
+        offset += delta;
+        if (offset > index.m_size) { throw_corrupt(path); }
+        index.m_samples.push_back(offset);
+    }
+    return index;
+}
+
+void LineIndex::save(std::string const & path) const
+{
+    std::string data(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put_varint(data, m_interval);
+    put_varint(data, m_newline == Newline::lf ? 1 : 0);
+    put_varint(data, m_size);
+    put_varint(data, static_cast<uint64_t>(m_mtime));
+    put_varint(data, m_newlines);
+    put_varint(data, static_cast<unsigned char>(m_last));
+    put_varint(data, m_samples.size());
+    uint64_t previous = 0;
+    for (uint64_t const offset : m_samples)
+    {
+        put_varint(data, offset - previous);
+        previous = offset;
+    }
+
+    std::string const tmp_path = path + ".tmp." + std::to_string(::getpid());
+    {
+        std::unique_ptr<FILE, int (*)(FILE *)> stream(std::fopen(tmp_path.c_str(), "wb"), std::fclose);
+        if (!stream) { throw_errno(tmp_path); }
+        if (std::fwrite(data.data(), 1, data.size(), stream.get()) != data.size()
+            || std::fflush(stream.get()) != 0)
+        {
+            int const error = errno;
+            ::unlink(tmp_path.c_str());
+            throw std::system_error(error, std::generic_category(), tmp_path);
+        }
+    }
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        int const error = errno;
+        ::unlink(tmp_path.c_str());
+        throw std::system_error(error, std::generic_category(), path);
+    }
+}
+
+bool LineIndex::fresh(int fd) const
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+    return static_cast<uint64_t>(st.st_size) == m_size && mtime_of(st) == m_mtime;
+}
+
+uint64_t LineIndex::offset(int fd, size_t line) const
+{
+    if (line >= lines()) { return m_size; }
+    uint64_t position = m_samples[line / m_interval];
+    size_t skip = line % m_interval;
+    LineSkipper skipper(m_newline);
+    char buffer[READ_SIZE];
+    while (skip && position < m_size)
+    {
+        size_t const length = static_cast<size_t>(std::min<uint64_t>(sizeof(buffer), m_size - position));
+        size_t const nread = pread_full(fd, buffer, length, static_cast<off_t>(position));
+        if (nread == 0) { break; }
+        position += static_cast<uint64_t>(skipper.skip(buffer, buffer + nread, skip) - buffer);
+    }
+    if (skipper.after_cr() && position < m_size)
+    {
+        char next = '\0';
+        if (pread_full(fd, &next, 1, static_cast<off_t>(position)) == 1 && next == '\n') { ++position; }
+    }
+    return position;
+}
+
+void LineIndex::read_lines(int fd, size_t first, size_t last,
+                           std::function<void(char const *, size_t)> const & sink) const
+{
+    if (first >= last) { return; }
+    uint64_t position = offset(fd, first);
+    size_t left = last - first;
+    LineSkipper skipper(m_newline);
+    char buffer[READ_SIZE];
+    // Once the last line is done, only the "\n" of a split "\r\n" is left.
+    while ((left || skipper.after_cr()) && position < m_size)
+    {
+        size_t const length = static_cast<size_t>(std::min<uint64_t>(sizeof(buffer), m_size - position));
+        size_t const nread = pread_full(fd, buffer, length, static_cast<off_t>(position));
+        if (nread == 0) { break; }
+        size_t const used = static_cast<size_t>(skipper.skip(buffer, buffer + (left ? nread : 1), left) - buffer);
+        sink(buffer, used);
+        position += used;
+        if (!left && used <= 1) { break; }
+    }
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
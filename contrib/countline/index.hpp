@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * Sidecar newline index for random access to the lines of large files.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace countline
+{
+
+/**
+ * Byte offsets of every interval-th line of a file.
+ *
+ * The index is built in the same pass that counts the lines: each buffer is
+ * counted with count_byte(), and only a buffer that holds a sampled newline is
+ * searched again to find where that line starts.  It records the size and
+ * modification time of the file so that a stale index is detected.
+ *
+ * On disk (FILE.clidx) the offsets are delta-encoded as LEB128 varints after a
+ * fixed header; a file with short lines needs about two bytes per sample.  In
+ * memory they are absolute, so finding line N takes one lookup plus reading
+ * at most interval lines from the file.
+ */
+class LineIndex
+{
+public:
+    static constexpr size_t DEFAULT_INTERVAL = 1024;
+
+    /// Where the index of the file at path is kept: path + ".clidx".
+    static std::string sidecar_path(std::string const & path);
+
+    /// Count the lines of the regular file on fd and sample their offsets.
+    static LineIndex build(int fd, size_t interval = DEFAULT_INTERVAL, Newline newline = Newline::universal);
+
+    /// Read an index saved by save().  Throws std::system_error on failure.
+    static LineIndex load(std::string const & path);
+
+    /// Write the index to path atomically.
+    void save(std::string const & path) const;
+
+    /// Whether the file on fd still has the size and time the index was built for.
+    bool fresh(int fd) const;
+
+    size_t interval() const { return m_interval; }
+    Newline newline() const { return m_newline; }
+    uint64_t size() const { return m_size; }
+    /// Number of lines, counting a final line without a trailing newline.
+    size_t lines() const { return m_newlines + ((m_size && !is_line_end(m_last, m_newline)) ? 1 : 0); }
+
+    /// Byte offset where line (0-based) starts; size() past the last line.
+    uint64_t offset(int fd, size_t line) const;
+
+    /// Pass the bytes of lines [first, last) (0-based) to sink in pieces.
+    void read_lines(int fd, size_t first, size_t last,
+                    std::function<void(char const *, size_t)> const & sink) const;
+
+private:
+    size_t m_interval = DEFAULT_INTERVAL;
+    Newline m_newline = Newline::universal;
+    uint64_t m_size = 0;
+    int64_t m_mtime = 0; // nanoseconds
+    size_t m_newlines = 0;
+    char m_last = '\n';
+    /// m_samples[i] is the offset of line i*m_interval.
+    std::vector<uint64_t> m_samples;
+}; /* end class LineIndex */
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
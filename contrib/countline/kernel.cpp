@@ -0,0 +1,199 @@
+#include "countline.hpp"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace countline
+{
+
+namespace
+{
+
+size_t count_byte_scalar(char const * data, size_t size, char c)
+{
+    size_t count = 0;
+    for (size_t it=0; it<size; ++it)
+    {
+        count += (data[it] == c);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_byte_avx2(char const * data, size_t size, char c)
+{
+    __m256i const needle = _mm256_set1_epi8(c);
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    size_t it = 0;
+    // Subtracting the 0/-1 comparison result accumulates per-lane byte
+    // counters; flush them with SAD before they can wrap at 255.
+    while (size - it >= 32)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        size_t const nblock = std::min<size_t>((size - it) / 32, 255);
+        for (size_t ib=0; ib<nblock; ++ib, it+=32)
+        {
+            __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + it));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+    size_t count = static_cast<size_t>(_mm256_extract_epi64(total, 0))
+                 + static_cast<size_t>(_mm256_extract_epi64(total, 1))
+                 + static_cast<size_t>(_mm256_extract_epi64(total, 2))
+                 + static_cast<size_t>(_mm256_extract_epi64(total, 3));
+    return count + count_byte_scalar(data + it, size - it, c);
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2,popcnt")))
+size_t count_byte_avx512(char const * data, size_t size, char c)
+{
+    __m512i const needle = _mm512_set1_epi8(c);
+    size_t count = 0;
+    size_t it = 0;
+    for (; size - it >= 256; it += 256)
+    {
+        __m512i const v0 = _mm512_loadu_si512(data + it);
+        __m512i const v1 = _mm512_loadu_si512(data + it + 64);
+        __m512i const v2 = _mm512_loadu_si512(data + it + 128);
+        __m512i const v3 = _mm512_loadu_si512(data + it + 192);
+        count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v0, needle))
+               + _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v1, needle))
+               + _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v2, needle))
+               + _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v3, needle));
+    }
+    for (; size - it >= 64; it += 64)
+    {
+        __m512i const v = _mm512_loadu_si512(data + it);
+        count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, needle));
+    }
+    if (it < size)
+    {
+        __mmask64 const tail = _bzhi_u64(~0ULL, static_cast<unsigned>(size - it));
+        __m512i const v = _mm512_maskz_loadu_epi8(tail, data + it);
+        count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(tail, v, needle));
+    }
+    return count;
+}
+
+/*
+ * Universal line ends are the "\n" bytes not preceded by "\r", plus every
+ * "\r".  With one bit per byte, the "\n" that complete a "\r\n" are
+ * lf & ((cr << 1) | carry), where carry is the "\r" bit of the byte before the
+ * block; since lf and cr are disjoint, the line ends are (lf | cr) ^ pairs.
+ */
+
+size_t count_line_ends_scalar(char const * data, size_t size, bool after_cr)
+{
+    size_t count = 0;
+    for (size_t it=0; it<size; ++it)
+    {
+        count += (data[it] == '\r') || (data[it] == '\n' && !after_cr);
+        after_cr = (data[it] == '\r');
+    }
+    return count;
+}
+
+size_t count_line_ends_scalar(char const * data, size_t size)
+{
+    return count_line_ends_scalar(data, size, false);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_line_ends_avx2(char const * data, size_t size)
+{
+    __m256i const lf = _mm256_set1_epi8('\n');
+    __m256i const cr = _mm256_set1_epi8('\r');
+    size_t count = 0;
+    uint64_t carry = 0;
+    size_t it = 0;
+    for (; size - it >= 64; it += 64)
+    {
+        __m256i const v0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + it));
+        __m256i const v1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + it + 32));
+        uint64_t const lf_mask = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, lf))))
+                               | uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, lf)))) << 32;
+        uint64_t const cr_mask = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, cr))))
+                               | uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, cr)))) << 32;
+        uint64_t const pairs = lf_mask & ((cr_mask << 1) | carry);
+        count += static_cast<size_t>(_mm_popcnt_u64((lf_mask | cr_mask) ^ pairs));
+        carry = cr_mask >> 63;
+    }
+    return count + count_line_ends_scalar(data + it, size - it, carry != 0);
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2,popcnt")))
+size_t count_line_ends_avx512(char const * data, size_t size)
+{
+    __m512i const lf = _mm512_set1_epi8('\n');
+    __m512i const cr = _mm512_set1_epi8('\r');
+    size_t count = 0;
+    uint64_t carry = 0;
+    for (size_t it=0; it<size; it+=64)
+    {
+        __mmask64 const valid = _bzhi_u64(~0ULL, static_cast<unsigned>(std::min<size_t>(64, size - it)));
+        __m512i const v = _mm512_maskz_loadu_epi8(valid, data + it);
+        uint64_t const lf_mask = _mm512_mask_cmpeq_epi8_mask(valid, v, lf);
+        uint64_t const cr_mask = _mm512_mask_cmpeq_epi8_mask(valid, v, cr);
+        uint64_t const pairs = lf_mask & ((cr_mask << 1) | carry);
+        count += static_cast<size_t>(_mm_popcnt_u64((lf_mask | cr_mask) ^ pairs));
+        carry = cr_mask >> 63;
+    }
+    return count;
+}
+
+using count_byte_type = size_t (*)(char const *, size_t, char);
+using count_line_ends_type = size_t (*)(char const *, size_t);
+
+struct Kernel
+{
+    count_byte_type count_byte;
+    count_line_ends_type count_line_ends;
+    char const * name;
+}; /* end struct Kernel */
+
+Kernel const & select_kernel()
+{
+    static Kernel const kernel = []()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2"))
+        {
+            return Kernel{count_byte_avx512, count_line_ends_avx512, "avx512"};
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return Kernel{count_byte_avx2, count_line_ends_avx2, "avx2"};
+        }
+        return Kernel{count_byte_scalar, count_line_ends_scalar, "scalar"};
+    }();
+    return kernel;
+}
+
+} /* end namespace */
+
+size_t count_byte(char const * data, size_t size, char c)
+{
+    return select_kernel().count_byte(data, size, c);
+}
+
+size_t count_line_ends(char const * data, size_t size, Newline newline)
+{
+    if (newline == Newline::lf)
+    {
+        return select_kernel().count_byte(data, size, '\n');
+    }
+    return select_kernel().count_line_ends(data, size);
+}
+
+char const * kernel_name()
+{
+    return select_kernel().name;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,791 @@
+/*
+ * Native drop-in for countline.py.
+ *
+ * The messages and the exit status follow countline.py: usage problems and
+ * missing files are reported on standard output with status 0.  Invalid
+ * options are reported on standard error with status 2.
+ *
+ * Started under a name ending in ".py" (a symbolic link named countline.py,
+ * or exec -a from the wrapper), it takes no options and treats every
+ * argument as a file name, exactly like the script.
+ *
+ * When COUNTLINE_SOCKET names the socket of a running "countline --daemon",
+ * plain line counts of a file are asked of the daemon, and made here when it
+ * does not answer.
+ *
+ * A file name of "-" reads standard input, which may be a pipe, in constant
+ * memory.
+ *
+ * Lines end at "\n", "\r\n" or a lone "\r", as with Python's text-mode
+ * readlines(); a final line without a line end counts.
+ *
+ * Options:
+ *   --newline=universal|lf
+ *          what ends a line (default universal; lf counts "\n" only)
+ *   -j N   count with N threads (0, the default, picks from the file size)
+ *   -m     accept many paths and print a total
+ *   -r     like -m, and descend into directories
+ *   -z     count the decompressed content of gzip, zstd and xz input
+ *   -e PATTERN
+ *          count the lines containing PATTERN instead (repeat for any of
+ *          several), printed as "N matching lines in FILE"
+ *   --estimate[=N]
+ *          estimate from N sampled 64 KiB blocks (default 64) with a 95%
+ *          interval; files no larger than the sample are counted exactly
+ *   --batch
+ *          read paths from standard input, one per line, and write a record
+ *          for each: path, lines, bytes, elapsed and error
+ *   -0, --null
+ *          with --batch, paths are separated by NUL bytes (find -print0)
+ *   --format=jsonl|csv
+ *          record format of --batch (default jsonl)
+ *   --watch
+ *          keep counting the given files, and the files in the given
+ *          directories, as they grow and rotate, until interrupted
+ *   --status=PATH
+ *          with --watch, rewrite PATH with the counts as JSON Lines
+ *   --socket=PATH
+ *          with --watch, send the counts to every client of the Unix socket
+ *          PATH
+ *   --interval=SECONDS
+ *          with --status, rewrite the file at most this often (default 1)
+ *   --daemon[=SOCKET]
+ *          serve counts on the Unix socket SOCKET (default $COUNTLINE_SOCKET,
+ *          $XDG_RUNTIME_DIR/countline.sock or /tmp/countline-UID.sock) from
+ *          a cache checked against stat(), until interrupted
+ *   --io=uring|pread
+ *          how -m and -r read files (default pread)
+ *   --page-cache=keep|drop|direct
+ *          keep what is read in the page cache (default), evict the pages
+ *          that were not cached before, or bypass the cache with O_DIRECT
+ *   --populate
+ *          prefault the whole mapping (MAP_POPULATE) before counting
+ *   --hugepage
+ *          ask for transparent huge pages on the mapping (MADV_HUGEPAGE)
+ *   --cache[=PATH]
+ *          remember counts in PATH (default ~/.cache/countline/cache) and
+ *          only read what was appended since the last run
+ *   --index[=K]
+ *          also write FILE.clidx, the offsets of every K-th line (default 1024)
+ *   --line=N[:M]
+ *          print line N, or lines N to M (from 1), seeking with FILE.clidx
+ *          when it is up to date
+ *
+ * Statistics in the style of wc(1), computed in the same pass (single file
+ * only); the output lists the selected ones in this order:
+ *   -l, --lines             lines
+ *   -w, --words             words
+ *   --chars                 UTF-8 characters
+ *   -c, --bytes             bytes
+ *   -L, --max-line-length   characters in the longest line
+ */
+
+#include "batch.hpp"
+#include "cache.hpp"
+#include "daemon.hpp"
+#include "countline.hpp"
+#include "estimate.hpp"
+#include "fileio.hpp"
+#include "index.hpp"
+#include "match.hpp"
+#include "stats.hpp"
+#include "walk.hpp"
+#include "watch.hpp"
+
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+
+bool parse_unsigned(char const * text, unsigned & value)
+{
+    char * end = nullptr;
+    unsigned long const parsed = std::strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || parsed > 4096) { return false; }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+/// Parse "N" or "N:M" (1-based, inclusive) into the 0-based range [first, last).
+bool parse_line_range(char const * text, size_t & first, size_t & last)
+{
+    char * end = nullptr;
+    unsigned long long const begin = std::strtoull(text, &end, 10);
+    if (end == text || begin == 0) { return false; }
+    unsigned long long finish = begin;
+    if (*end == ':')
+    {
+        char const * rest = end + 1;
+        finish = std::strtoull(rest, &end, 10);
+        if (end == rest || finish < begin) { return false; }
+    }
+    if (*end != '\0' || text[0] == '-') { return false; }
+    first = static_cast<size_t>(begin - 1);
+    last = static_cast<size_t>(finish);
+    return true;
+}
+
+/// Print the selected statistics as "A lines, B words, ... in FILE".
+void print_stats(countline::TextStats const & stats, unsigned fields, char const * fname)
+{
+    struct Field { unsigned flag; size_t value; char const * name; };
+    Field const table[] =
+    {
+        {countline::STAT_LINES, stats.lines, "lines"},
+        {countline::STAT_WORDS, stats.words, "words"},
+        {countline::STAT_CHARS, stats.chars, "characters"},
+        {countline::STAT_BYTES, stats.bytes, "bytes"},
+        {countline::STAT_MAX_LINE, stats.max_line, "max line length"},
+    };
+    char const * separator = "";
+    for (Field const & field : table)
+    {
+        if (!(fields & field.flag)) { continue; }
+        std::printf("%s%zu %s", separator, field.value, field.name);
+        separator = ", ";
+    }
+    std::printf(" in %s\n", fname);
+}
+
+/// Count one file (or standard input for "-") like countline.py does.
+int count_one(char const * fname, countline::Options const & options, unsigned fields, countline::LineCache * cache,
+              char const * daemon_socket)
+{
+    bool const is_stdin = std::strcmp(fname, "-") == 0;
+    struct stat st;
+    if (!is_stdin && ::stat(fname, &st) != 0)
+    {
+        std::printf("%s not found\n", fname);
+        return 0;
+    }
+    countline::DaemonReply reply;
+    if (daemon_socket && !is_stdin && !cache && !options.decompress && !(fields & ~countline::STAT_LINES)
+        && countline::query_daemon(daemon_socket, fname, options.newline, reply))
+    {
+        if (reply.error)
+        {
+            std::fprintf(stderr, "countline: %s: %s\n", fname, std::strerror(reply.error));
+            return 1;
+        }
+        std::printf("%zu lines in %s\n", reply.lines, fname);
+        return 0;
+    }
+    try
+    {
+        if (fields & ~countline::STAT_LINES)
+        {
+            countline::TextStats stats;
+            if (is_stdin) { stats = countline::count_stats_fd(STDIN_FILENO, fields, options.newline); }
+            else
+            {
+                countline::File const file(fname);
+                stats = countline::count_stats_fd(file.fd(), fields, options.newline);
+            }
+            print_stats(stats, fields, fname);
+        }
+        else
+        {
+            size_t const nline = is_stdin ? countline::count_fd(STDIN_FILENO, options)
+                               : cache ? cache->count(fname)
+                                       : countline::count_file(fname, options);
+            std::printf("%zu lines in %s\n", nline, fname);
+        }
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s%s%s\n", is_stdin ? "" : fname, is_stdin ? "" : ": ", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Count one file through its line index, rebuilding a stale or missing one,
+ * and print either the count or the lines [first, last).
+ */
+int index_one(char const * fname, countline::Newline newline, size_t interval, bool save, bool extract, size_t first, size_t last)
+{
+    struct stat st;
+    if (::stat(fname, &st) != 0)
+    {
+        std::printf("%s not found\n", fname);
+        return 0;
+    }
+    std::string const sidecar = countline::LineIndex::sidecar_path(fname);
+    try
+    {
+        countline::File const file(fname);
+        countline::LineIndex index;
+        bool current = false;
+        try
+        {
+            index = countline::LineIndex::load(sidecar);
+            current = index.fresh(file.fd()) && index.newline() == newline && (!save || index.interval() == interval);
+        }
+        catch (std::system_error const & )
+        {
+            // Missing or unreadable: build a new one.
+        }
+        if (!current)
+        {
+            index = countline::LineIndex::build(file.fd(), interval, newline);
+            if (save) { index.save(sidecar); }
+        }
+        if (!extract)
+        {
+            std::printf("%zu lines in %s\n", index.lines(), fname);
+        }
+        else if (first >= index.lines())
+        {
+            std::fprintf(stderr, "countline: %s: line %zu is past the end (%zu lines)\n", fname, first + 1, index.lines());
+            return 1;
+        }
+        else
+        {
+            index.read_lines(file.fd(), first, last, [](char const * data, size_t size)
+            {
+                std::fwrite(data, 1, size, stdout);
+            });
+        }
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s: %s\n", fname, e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Count the lines of one file (or standard input) that contain a pattern.
+int match_one(char const * fname, std::vector<std::string> const & patterns, countline::Options const & options)
+{
+    bool const is_stdin = std::strcmp(fname, "-") == 0;
+    struct stat st;
+    if (!is_stdin && ::stat(fname, &st) != 0)
+    {
+        std::printf("%s not found\n", fname);
+        return 0;
+    }
+    try
+    {
+        countline::PatternMatcher const matcher(patterns, options.newline);
+        size_t nline;
+        if (is_stdin) { nline = countline::count_matching_fd(STDIN_FILENO, matcher, options.nthread); }
+        else
+        {
+            countline::File const file(fname);
+            nline = countline::count_matching_fd(file.fd(), matcher, options.nthread);
+        }
+        std::printf("%zu matching lines in %s\n", nline, fname);
+    }
+    catch (std::invalid_argument const & e)
+    {
+        std::fprintf(stderr, "countline: %s\n", e.what());
+        return 2;
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s%s%s\n", is_stdin ? "" : fname, is_stdin ? "" : ": ", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Estimate the lines of one file and say whether the count is exact.
+int estimate_one(char const * fname, countline::EstimateOptions const & options)
+{
+    struct stat st;
+    if (::stat(fname, &st) != 0)
+    {
+        std::printf("%s not found\n", fname);
+        return 0;
+    }
+    try
+    {
+        countline::File const file(fname);
+        countline::Estimate const estimate = countline::estimate_lines(file.fd(), options);
+        if (estimate.exact)
+        {
+            std::printf("%zu lines in %s (exact)\n", estimate.lines, fname);
+        }
+        else
+        {
+            std::printf("~%zu lines in %s (estimated from %u blocks, 95%% interval %zu-%zu)\n",
+                        estimate.lines, fname, estimate.nblock, estimate.low, estimate.high);
+        }
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s: %s\n", fname, e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Save the cache if there is one; the exit status for the outcome.
+int save_cache(countline::LineCache * cache)
+{
+    if (!cache) { return 0; }
+    try
+    {
+        cache->save();
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: cannot save cache: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Count many paths and print one line per file followed by the total.
+int count_many(std::vector<std::string> const & paths, countline::WalkOptions const & options)
+{
+    int status = 0;
+    size_t total = 0;
+    for (countline::FileCount const & count : countline::count_paths(paths, options))
+    {
+        if (count.error == 0)
+        {
+            total += count.lines;
+            std::printf("%zu lines in %s\n", count.lines, count.path.c_str());
+        }
+        else if (count.error == ENOENT)
+        {
+            std::printf("%s not found\n", count.path.c_str());
+        }
+        else
+        {
+            std::fprintf(stderr, "countline: %s: %s\n", count.path.c_str(), std::strerror(count.error));
+            status = 1;
+        }
+    }
+    std::printf("%zu lines in total\n", total);
+    return status;
+}
+
+/// Answer count requests until interrupted.
+int serve_daemon(std::string const & socket_path, countline::DaemonOptions const & options)
+{
+    try
+    {
+        countline::run_daemon(socket_path, options);
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Keep counting paths until interrupted.
+int watch_paths(std::vector<std::string> const & paths, countline::WatchOptions const & options)
+{
+    try
+    {
+        countline::run_watch(paths, options);
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Whether the program was started under a name ending in ".py".
+bool started_as_script(char const * argv0)
+{
+    size_t const length = std::strlen(argv0);
+    return length >= 3 && std::strcmp(argv0 + length - 3, ".py") == 0;
+}
+
+/**
+ * countline.py exactly: no options, and every argument, "-" included, is a
+ * file name.
+ */
+int script_main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        std::fputs("missing file name\n", stdout);
+        return 0;
+    }
+    if (argc > 2)
+    {
+        std::fputs("only one argument is allowed\n", stdout);
+        return 0;
+    }
+    char const * fname = argv[1];
+    struct stat st;
+    if (::stat(fname, &st) != 0)
+    {
+        std::printf("%s not found\n", fname);
+        return 0;
+    }
+    try
+    {
+        countline::Options options;
+        options.nthread = 0;
+        std::printf("%zu lines in %s\n", countline::count_file(fname, options), fname);
+    }
+    catch (std::system_error const & e)
+    {
+        std::fprintf(stderr, "countline: %s: %s\n", fname, std::strerror(e.code().value()));
+        return 1;
+    }
+    return 0;
+}
+
+} /* end namespace */
+
+int main(int argc, char ** argv)
+{
+    if (argc > 0 && started_as_script(argv[0])) { return script_main(argc, argv); }
+
+    countline::Options options;
+    options.nthread = 0;
+    bool many = false;
+    countline::WalkOptions walk_options;
+
+    unsigned fields = 0;
+    bool use_cache = false;
+    std::string cache_path;
+    bool write_index = false;
+    size_t index_interval = countline::LineIndex::DEFAULT_INTERVAL;
+    bool extract = false;
+    size_t first_line = 0;
+    size_t last_line = 0;
+    std::vector<std::string> patterns;
+    bool estimate = false;
+    bool batch = false;
+    countline::BatchOptions batch_options;
+    countline::EstimateOptions estimate_options;
+    bool watch = false;
+    bool daemon = false;
+    std::string daemon_path;
+    countline::WatchOptions watch_options;
+
+    enum { OPT_IO = 256, OPT_CHARS, OPT_CACHE, OPT_INDEX, OPT_LINE, OPT_NEWLINE, OPT_ESTIMATE, OPT_BATCH, OPT_FORMAT,
+           OPT_PAGE_CACHE, OPT_POPULATE, OPT_HUGEPAGE, OPT_WATCH, OPT_STATUS, OPT_SOCKET, OPT_INTERVAL,
+           OPT_DAEMON };
+    static struct option const long_options[] =
+    {
+        {"io", required_argument, nullptr, OPT_IO},
+        {"newline", required_argument, nullptr, OPT_NEWLINE},
+        {"lines", no_argument, nullptr, 'l'},
+        {"words", no_argument, nullptr, 'w'},
+        {"chars", no_argument, nullptr, OPT_CHARS},
+        {"bytes", no_argument, nullptr, 'c'},
+        {"max-line-length", no_argument, nullptr, 'L'},
+        {"cache", optional_argument, nullptr, OPT_CACHE},
+        {"index", optional_argument, nullptr, OPT_INDEX},
+        {"line", required_argument, nullptr, OPT_LINE},
+        {"estimate", optional_argument, nullptr, OPT_ESTIMATE},
+        {"batch", no_argument, nullptr, OPT_BATCH},
+        {"null", no_argument, nullptr, '0'},
+        {"format", required_argument, nullptr, OPT_FORMAT},
+        {"page-cache", required_argument, nullptr, OPT_PAGE_CACHE},
+        {"populate", no_argument, nullptr, OPT_POPULATE},
+        {"hugepage", no_argument, nullptr, OPT_HUGEPAGE},
+        {"watch", no_argument, nullptr, OPT_WATCH},
+        {"status", required_argument, nullptr, OPT_STATUS},
+        {"socket", required_argument, nullptr, OPT_SOCKET},
+        {"interval", required_argument, nullptr, OPT_INTERVAL},
+        {"daemon", optional_argument, nullptr, OPT_DAEMON},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int opt;
+    while ((opt = ::getopt_long(argc, argv, "j:mrzlwcLe:0", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case OPT_IO:
+            if (std::strcmp(optarg, "uring") == 0) { walk_options.io = countline::IoBackend::uring; }
+            else if (std::strcmp(optarg, "pread") == 0) { walk_options.io = countline::IoBackend::pread; }
+            else
+            {
+                std::fprintf(stderr, "countline: invalid I/O backend: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case OPT_NEWLINE:
+            if (std::strcmp(optarg, "universal") == 0) { options.newline = countline::Newline::universal; }
+            else if (std::strcmp(optarg, "lf") == 0) { options.newline = countline::Newline::lf; }
+            else
+            {
+                std::fprintf(stderr, "countline: invalid newline mode: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case OPT_PAGE_CACHE:
+            if (std::strcmp(optarg, "keep") == 0) { options.page_cache = countline::PageCache::keep; }
+            else if (std::strcmp(optarg, "drop") == 0) { options.page_cache = countline::PageCache::drop; }
+            else if (std::strcmp(optarg, "direct") == 0) { options.page_cache = countline::PageCache::direct; }
+            else
+            {
+                std::fprintf(stderr, "countline: invalid page cache policy: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case OPT_POPULATE:
+            options.populate = true;
+            break;
+        case OPT_HUGEPAGE:
+            options.hugepage = true;
+            break;
+        case OPT_DAEMON:
+            daemon = true;
+            if (optarg) { daemon_path = optarg; }
+            break;
+        case OPT_WATCH:
+            watch = true;
+            break;
+        case OPT_STATUS:
+            watch_options.status_path = optarg;
+            break;
+        case OPT_SOCKET:
+            watch_options.socket_path = optarg;
+            break;
+        case OPT_INTERVAL:
+            if (!parse_unsigned(optarg, watch_options.interval) || watch_options.interval == 0)
+            {
+                std::fprintf(stderr, "countline: invalid interval: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'm':
+            many = true;
+            break;
+        case OPT_CACHE:
+            use_cache = true;
+            cache_path = optarg ? optarg : countline::LineCache::default_path();
+            break;
+        case OPT_INDEX:
+            write_index = true;
+            if (optarg)
+            {
+                unsigned interval = 0;
+                if (!parse_unsigned(optarg, interval) || interval == 0)
+                {
+                    std::fprintf(stderr, "countline: invalid index interval: %s\n", optarg);
+                    return 2;
+                }
+                index_interval = interval;
+            }
+            break;
+        case OPT_BATCH:
+            batch = true;
+            break;
+        case '0':
+            batch_options.separator = '\0';
+            break;
+        case OPT_FORMAT:
+            if (std::strcmp(optarg, "jsonl") == 0) { batch_options.format = countline::BatchFormat::jsonl; }
+            else if (std::strcmp(optarg, "csv") == 0) { batch_options.format = countline::BatchFormat::csv; }
+            else
+            {
+                std::fprintf(stderr, "countline: invalid format: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case OPT_ESTIMATE:
+            estimate = true;
+            if (optarg && (!parse_unsigned(optarg, estimate_options.nblock) || estimate_options.nblock == 0))
+            {
+                std::fprintf(stderr, "countline: invalid block count: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case OPT_LINE:
+            if (!parse_line_range(optarg, first_line, last_line))
+            {
+                std::fprintf(stderr, "countline: invalid line range: %s\n", optarg);
+                return 2;
+            }
+            extract = true;
+            break;
+        case 'l': fields |= countline::STAT_LINES; break;
+        case 'w': fields |= countline::STAT_WORDS; break;
+        case OPT_CHARS: fields |= countline::STAT_CHARS; break;
+        case 'c': fields |= countline::STAT_BYTES; break;
+        case 'L': fields |= countline::STAT_MAX_LINE; break;
+        case 'z':
+            options.decompress = true;
+            break;
+        case 'e':
+            patterns.push_back(optarg);
+            break;
+        case 'r':
+            many = true;
+            walk_options.recursive = true;
+            break;
+        case 'j':
+            if (!parse_unsigned(optarg, options.nthread))
+            {
+                std::fprintf(stderr, "countline: invalid thread count: %s\n", optarg);
+                return 2;
+            }
+            break;
+        default:
+            return 2;
+        }
+    }
+
+    if ((fields & ~countline::STAT_LINES) && (many || options.decompress))
+    {
+        std::fputs("countline: statistics other than lines take a single uncompressed file\n", stderr);
+        return 2;
+    }
+
+    if (use_cache && ((fields & ~countline::STAT_LINES) || options.decompress))
+    {
+        std::fputs("countline: --cache only applies to line counts of uncompressed files\n", stderr);
+        return 2;
+    }
+    if (!patterns.empty() && (many || fields || options.decompress || use_cache || write_index || extract))
+    {
+        std::fputs("countline: -e takes a single uncompressed file and no other mode\n", stderr);
+        return 2;
+    }
+
+    if ((!watch_options.status_path.empty() || !watch_options.socket_path.empty()) && !watch)
+    {
+        std::fputs("countline: --status and --socket need --watch\n", stderr);
+        return 2;
+    }
+    if (daemon)
+    {
+        if (optind != argc || watch || batch || many || fields || options.decompress || use_cache || write_index
+            || extract || !patterns.empty() || estimate)
+        {
+            std::fputs("countline: --daemon takes no file and no other mode\n", stderr);
+            return 2;
+        }
+        countline::DaemonOptions daemon_options;
+        daemon_options.nthread = options.nthread;
+        daemon_options.page_cache = options.page_cache;
+        daemon_options.populate = options.populate;
+        daemon_options.hugepage = options.hugepage;
+        return serve_daemon(daemon_path.empty() ? countline::default_socket_path() : daemon_path, daemon_options);
+    }
+    if (watch)
+    {
+        if (optind == argc || batch || many || fields || options.decompress || use_cache || write_index || extract
+            || !patterns.empty() || estimate)
+        {
+            std::fputs("countline: --watch takes files and directories and no other mode\n", stderr);
+            return 2;
+        }
+        watch_options.newline = options.newline;
+        return watch_paths(std::vector<std::string>(argv + optind, argv + argc), watch_options);
+    }
+
+    if (batch)
+    {
+        if (optind != argc || many || fields || use_cache || write_index || extract || !patterns.empty() || estimate)
+        {
+            std::fputs("countline: --batch reads paths from standard input and takes no other mode\n", stderr);
+            return 2;
+        }
+        batch_options.nthread = options.nthread;
+        batch_options.count.decompress = options.decompress;
+        batch_options.count.newline = options.newline;
+        batch_options.count.page_cache = options.page_cache;
+        batch_options.count.populate = options.populate;
+        batch_options.count.hugepage = options.hugepage;
+        return countline::run_batch(stdin, stdout, batch_options) ? 1 : 0;
+    }
+
+    if (estimate && (many || fields || options.decompress || use_cache || write_index || extract || !patterns.empty()))
+    {
+        std::fputs("countline: --estimate takes a single uncompressed file and no other mode\n", stderr);
+        return 2;
+    }
+
+    bool const indexed = write_index || extract;
+    if (indexed && (many || fields || options.decompress || use_cache))
+    {
+        std::fputs("countline: --index and --line take a single uncompressed file and no other mode\n", stderr);
+        return 2;
+    }
+
+    if (use_cache && (options.page_cache != countline::PageCache::keep || options.populate || options.hugepage))
+    {
+        std::fputs("countline: --cache reads with pread() and takes no --page-cache, --populate or --hugepage\n", stderr);
+        return 2;
+    }
+
+    std::unique_ptr<countline::LineCache> cache;
+    if (use_cache) { cache.reset(new countline::LineCache(cache_path, options.newline)); }
+
+    int const narg = argc - optind;
+    if (narg < 1)
+    {
+        std::fputs("missing file name\n", stdout);
+    }
+    else if (many)
+    {
+        walk_options.nthread = options.nthread;
+        walk_options.decompress = options.decompress;
+        walk_options.newline = options.newline;
+        walk_options.page_cache = options.page_cache;
+        walk_options.populate = options.populate;
+        walk_options.hugepage = options.hugepage;
+        walk_options.cache = cache.get();
+        int const status = count_many(std::vector<std::string>(argv + optind, argv + argc), walk_options);
+        return std::max(status, save_cache(cache.get()));
+    }
+    else if (narg > 1)
+    {
+        std::fputs("only one argument is allowed\n", stdout);
+    }
+    else if (estimate)
+    {
+        if (std::strcmp(argv[optind], "-") == 0)
+        {
+            std::fputs("countline: --estimate needs a regular file\n", stderr);
+            return 2;
+        }
+        estimate_options.newline = options.newline;
+        return estimate_one(argv[optind], estimate_options);
+    }
+    else if (!patterns.empty())
+    {
+        return match_one(argv[optind], patterns, options);
+    }
+    else if (indexed)
+    {
+        if (std::strcmp(argv[optind], "-") == 0)
+        {
+            std::fputs("countline: --index and --line need a regular file\n", stderr);
+            return 2;
+        }
+        return index_one(argv[optind], options.newline, index_interval, write_index, extract, first_line, last_line);
+    }
+    else
+    {
+        char const * daemon_socket = std::getenv("COUNTLINE_SOCKET");
+        if (daemon_socket && !*daemon_socket) { daemon_socket = nullptr; }
+        int const status = count_one(argv[optind], options, fields, cache.get(), daemon_socket);
+        return std::max(status, save_cache(cache.get()));
+    }
+    return 0;
+}
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,333 @@
+#include "match.hpp"
+#include "fileio.hpp"
+
+#include <immintrin.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace countline
+{
+
+namespace
+{
+
+constexpr size_t CHUNK_SIZE = 4 << 20;
+
+using Patterns = std::vector<std::string>;
+
+/// Whether pattern occurs at it; its first and last bytes are already known to.
+inline bool confirm(char const * it, std::string const & pattern)
+{
+    return pattern.size() <= 2 || std::memcmp(it + 1, pattern.data() + 1, pattern.size() - 2) == 0;
+}
+
+/// First occurrence of any pattern in [it, end), or nullptr.
+char const * find_scalar(char const * it, char const * end, Patterns const & patterns)
+{
+    for (; it < end; ++it)
+    {
+        for (std::string const & pattern : patterns)
+        {
+            size_t const last = pattern.size() - 1;
+            if (static_cast<size_t>(end - it) > last && it[0] == pattern[0] && it[last] == pattern[last]
+                && confirm(it, pattern))
+            {
+                return it;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/// First line end in [it, end), or end.
+char const * find_line_end_scalar(char const * it, char const * end, Newline newline)
+{
+    if (newline == Newline::lf)
+    {
+        char const * found = static_cast<char const *>(std::memchr(it, '\n', end - it));
+        return found ? found : end;
+    }
+    for (; it < end && *it != '\n' && *it != '\r'; ++it) {}
+    return it;
+}
+
+/// Lowest confirmed candidate among the bits of mask, or 64.
+inline unsigned first_confirmed(uint64_t mask, char const * block, std::string const & pattern)
+{
+    for (; mask; mask &= mask - 1)
+    {
+        unsigned const bit = static_cast<unsigned>(__builtin_ctzll(mask));
+        if (confirm(block + bit, pattern)) { return bit; }
+    }
+    return 64;
+}
+
+/*
+ * The vector searches test the positions [it, it+width) at once.  Loading the
+ * last byte of the longest pattern at each of them must stay within the
+ * range, so the final positions are left to the scalar search.
+ */
+
+__attribute__((target("avx2,bmi")))
+char const * find_avx2(char const * it, char const * end, Patterns const & patterns, size_t maxlen)
+{
+    for (; static_cast<size_t>(end - it) >= 32 + maxlen - 1; it += 32)
+    {
+        unsigned best = 64;
+        for (std::string const & pattern : patterns)
+        {
+            size_t const last = pattern.size() - 1;
+            __m256i const head = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(it));
+            __m256i const tail = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(it + last));
+            __m256i const both = _mm256_and_si256(_mm256_cmpeq_epi8(head, _mm256_set1_epi8(pattern[0])),
+                                                  _mm256_cmpeq_epi8(tail, _mm256_set1_epi8(pattern[last])));
+            uint64_t mask = uint32_t(_mm256_movemask_epi8(both));
+            if (best < 64) { mask &= (uint64_t(1) << best) - 1; }
+            best = std::min(best, first_confirmed(mask, it, pattern));
+        }
+        if (best < 64) { return it + best; }
+    }
+    return find_scalar(it, end, patterns);
+}
+
+__attribute__((target("avx2,bmi")))
+char const * find_line_end_avx2(char const * it, char const * end, Newline newline)
+{
+    if (newline == Newline::lf) { return find_line_end_scalar(it, end, newline); }
+    for (; end - it >= 32; it += 32)
+    {
+        __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(it));
+        __m256i const hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        uint32_t const mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask) { return it + __builtin_ctz(mask); }
+    }
+    return find_line_end_scalar(it, end, newline);
+}
+
+__attribute__((target("avx512f,avx512bw,bmi")))
+char const * find_avx512(char const * it, char const * end, Patterns const & patterns, size_t maxlen)
+{
+    for (; static_cast<size_t>(end - it) >= 64 + maxlen - 1; it += 64)
+    {
+        __m512i const head = _mm512_loadu_si512(it);
+        unsigned best = 64;
+        for (std::string const & pattern : patterns)
+        {
+            size_t const last = pattern.size() - 1;
+            __m512i const tail = _mm512_loadu_si512(it + last);
+            uint64_t mask = _mm512_cmpeq_epi8_mask(head, _mm512_set1_epi8(pattern[0]))
+                          & _mm512_cmpeq_epi8_mask(tail, _mm512_set1_epi8(pattern[last]));
+            if (best < 64) { mask &= (uint64_t(1) << best) - 1; }
+            best = std::min(best, first_confirmed(mask, it, pattern));
+        }
+        if (best < 64) { return it + best; }
+    }
+    return find_scalar(it, end, patterns);
+}
+
+__attribute__((target("avx512f,avx512bw,bmi,bmi2")))
+char const * find_line_end_avx512(char const * it, char const * end, Newline newline)
+{
+    __m512i const lf = _mm512_set1_epi8('\n');
+    __m512i const cr = _mm512_set1_epi8(newline == Newline::universal ? '\r' : '\n');
+    for (; it < end; it += 64)
+    {
+        __mmask64 const valid = _bzhi_u64(~0ULL, static_cast<unsigned>(std::min<ptrdiff_t>(64, end - it)));
+        __m512i const v = _mm512_maskz_loadu_epi8(valid, it);
+        uint64_t const mask = _mm512_mask_cmpeq_epi8_mask(valid, v, lf) | _mm512_mask_cmpeq_epi8_mask(valid, v, cr);
+        if (mask) { return it + __builtin_ctzll(mask); }
+    }
+    return end;
+}
+
+char const * find_generic(char const * it, char const * end, Patterns const & patterns, size_t )
+{
+    return find_scalar(it, end, patterns);
+}
+
+struct Search
+{
+    char const * (*find)(char const *, char const *, Patterns const &, size_t);
+    char const * (*find_line_end)(char const *, char const *, Newline);
+}; /* end struct Search */
+
+Search const & select_search()
+{
+    static Search const search = []()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2"))
+        {
+            return Search{find_avx512, find_line_end_avx512};
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        {
+            return Search{find_avx2, find_line_end_avx2};
+        }
+        return Search{find_generic, find_line_end_scalar};
+    }();
+    return search;
+}
+
+/// Count [data, data+size) in chunks cut at line ends, with nthread workers.
+size_t count_chunked(char const * data, size_t size, PatternMatcher const & matcher, unsigned nthread)
+{
+    std::vector<size_t> bounds(1, 0);
+    while (bounds.back() < size)
+    {
+        size_t const begin = bounds.back();
+        if (size - begin <= CHUNK_SIZE) { bounds.push_back(size); break; }
+        char const * end = select_search().find_line_end(data + begin + CHUNK_SIZE, data + size, matcher.newline());
+        size_t bound = std::min(size, static_cast<size_t>(end - data) + 1);
+        if (bound < size && data[bound - 1] == '\r' && data[bound] == '\n') { ++bound; } // keep "\r\n" whole
+        bounds.push_back(bound);
+    }
+    size_t const nchunk = bounds.size() - 1;
+    nthread = static_cast<unsigned>(std::min<size_t>(nthread, nchunk));
+
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<size_t> total(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]()
+    {
+        try
+        {
+            size_t local = 0;
+            for (;;)
+            {
+                size_t const ichunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+                if (ichunk >= nchunk) { break; }
+                local += matcher.count(data + bounds[ichunk], bounds[ichunk + 1] - bounds[ichunk]);
+            }
+            total.fetch_add(local, std::memory_order_relaxed);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) { error = std::current_exception(); }
+            next_chunk.store(nchunk, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned it=1; it<nthread; ++it)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    if (error) { std::rethrow_exception(error); }
+    return total.load();
+}
+
+/// Count what read() returns until end of file, a buffer of whole lines at a time.
+size_t count_streamed(int fd, PatternMatcher const & matcher)
+{
+    std::vector<char> buffer(STREAM_BUFFER_SIZE);
+    size_t filled = 0;
+    size_t total = 0;
+    for (;;)
+    {
+        if (filled == buffer.size()) { buffer.resize(2 * buffer.size()); } // a line longer than the buffer
+        ssize_t const nread = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+        if (nread < 0)
+        {
+            if (errno == EINTR) { continue; }
+            throw_errno("read");
+        }
+        if (nread == 0)
+        {
+            total += matcher.count(buffer.data(), filled);
+            return total;
+        }
+        filled += static_cast<size_t>(nread);
+        // Count up to the last line end; keep the partial line after it.  A
+        // final "\r" may yet be followed by its "\n".
+        size_t whole = filled;
+        if (buffer[whole - 1] == '\r') { --whole; }
+        while (whole && !is_line_end(buffer[whole - 1], matcher.newline())) { --whole; }
+        if (whole == 0) { continue; }
+        total += matcher.count(buffer.data(), whole);
+        std::memmove(buffer.data(), buffer.data() + whole, filled - whole);
+        filled -= whole;
+    }
+}
+
+} /* end namespace */
+
+PatternMatcher::PatternMatcher(std::vector<std::string> patterns, Newline newline)
+  : m_newline(newline)
+{
+    if (patterns.empty()) { throw std::invalid_argument("no pattern to match"); }
+    for (std::string & pattern : patterns)
+    {
+        if (pattern.find('\n') != std::string::npos
+            || (newline == Newline::universal && pattern.find('\r') != std::string::npos))
+        {
+            throw std::invalid_argument("a pattern cannot contain a line end");
+        }
+        if (pattern.empty()) { m_match_all = true; }
+        m_patterns.push_back(std::move(pattern));
+    }
+}
+
+size_t PatternMatcher::count(char const * data, size_t size) const
+{
+    if (m_match_all)
+    {
+        LineCounter counter(m_newline);
+        counter.update(data, size);
+        return counter.lines();
+    }
+    Search const & search = select_search();
+    size_t maxlen = 0;
+    for (std::string const & pattern : m_patterns) { maxlen = std::max(maxlen, pattern.size()); }
+
+    size_t count = 0;
+    char const * it = data;
+    char const * const end = data + size;
+    while (it < end)
+    {
+        char const * match = search.find(it, end, m_patterns, maxlen);
+        if (!match) { break; }
+        ++count;
+        char const * line_end = search.find_line_end(match, end, m_newline);
+        if (line_end == end) { break; }
+        it = line_end + 1;
+    }
+    return count;
+}
+
+size_t count_matching_fd(int fd, PatternMatcher const & matcher, unsigned nthread)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        size_t const size = static_cast<size_t>(st.st_size);
+        Mapping const mapping(fd, size);
+        if (mapping)
+        {
+            return count_chunked(mapping.data(), size, matcher, nthread ? nthread : auto_thread_count(size));
+        }
+    }
+    return count_streamed(fd, matcher);
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
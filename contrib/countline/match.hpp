@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * Counting the lines that contain literal patterns.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace countline
+{
+
+/**
+ * Count the lines holding at least one of a set of literal patterns.
+ *
+ * Candidates are found a vector of positions at a time (64 with AVX-512BW,
+ * 32 with AVX2): a position is a candidate for a pattern when both its first
+ * and its last byte are where the pattern has them, and only candidates are
+ * compared with memcmp().  Once a line matches, the search jumps to its line
+ * end, found with the same vector compares, so a matching line is counted
+ * once and nothing is built per line.  The cost grows with the number of
+ * patterns; rare first and last bytes make the filter sharper.
+ */
+class PatternMatcher
+{
+public:
+    /**
+     * Patterns may not contain line ends ("\n", and "\r" in universal mode);
+     * throws std::invalid_argument if one does or if there are none.  An
+     * empty pattern matches every line.
+     */
+    PatternMatcher(std::vector<std::string> patterns, Newline newline = Newline::universal);
+
+    Newline newline() const { return m_newline; }
+
+    /**
+     * Count the matching lines in [data, data+size), which starts at the
+     * beginning of a line and ends at a line end or at the end of the input.
+     */
+    size_t count(char const * data, size_t size) const;
+
+private:
+    std::vector<std::string> m_patterns;
+    Newline m_newline;
+    bool m_match_all = false;
+}; /* end class PatternMatcher */
+
+/**
+ * Count the matching lines readable from fd.  A regular file is mapped and
+ * cut at line ends into chunks that nthread threads (0 picks from the size)
+ * count independently; anything else is streamed.  Throws std::system_error
+ * on failure.
+ */
+size_t count_matching_fd(int fd, PatternMatcher const & matcher, unsigned nthread = 0);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
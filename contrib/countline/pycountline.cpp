@@ -0,0 +1,117 @@
+/*
+ * Python binding of the native line-counting engine (module _countline).
+ *
+ * count_lines() takes a path, an open file descriptor, or any object
+ * exporting the buffer protocol (bytes, bytearray, memoryview, mmap), and
+ * returns what len(readlines()) would.  A descriptor is counted from its
+ * current offset.  The GIL is released while the file is
+ * read and counted, so other Python threads keep running.
+ */
+
+#include "countline.hpp"
+
+#include <pybind11/pybind11.h>
+
+#include <string>
+#include <system_error>
+
+namespace py = pybind11;
+
+namespace
+{
+
+countline::Newline parse_mode(std::string const & mode)
+{
+    if (mode == "universal") { return countline::Newline::universal; }
+    if (mode == "lf") { return countline::Newline::lf; }
+    throw py::value_error("mode must be 'universal' or 'lf', not '" + mode + "'");
+}
+
+/// Holds a C-contiguous view of a buffer-protocol object.
+class BufferView
+{
+public:
+    explicit BufferView(py::handle source)
+    {
+        if (PyObject_GetBuffer(source.ptr(), &m_view, PyBUF_C_CONTIGUOUS) != 0)
+        {
+            throw py::error_already_set();
+        }
+    }
+    BufferView(BufferView const & ) = delete;
+    BufferView & operator=(BufferView const & ) = delete;
+    ~BufferView() { PyBuffer_Release(&m_view); }
+    char const * data() const { return static_cast<char const *>(m_view.buf); }
+    size_t size() const { return static_cast<size_t>(m_view.len); }
+private:
+    Py_buffer m_view;
+}; /* end class BufferView */
+
+size_t count_buffer(py::handle source, countline::Newline newline)
+{
+    BufferView const view(source);
+    py::gil_scoped_release release;
+    countline::LineCounter counter(newline);
+    counter.update(view.data(), view.size());
+    return counter.lines();
+}
+
+size_t count_lines(py::object const & source, std::string const & mode, unsigned nthread)
+{
+    countline::Options options;
+    options.newline = parse_mode(mode);
+    options.nthread = nthread;
+
+    if (py::isinstance<py::int_>(source))
+    {
+        int const fd = source.cast<int>();
+        py::gil_scoped_release release;
+        return countline::count_fd(fd, options);
+    }
+    if (py::isinstance<py::str>(source) || py::hasattr(source, "__fspath__"))
+    {
+        // str, and os.PathLike objects such as pathlib.Path.
+        std::string const path = py::hasattr(source, "__fspath__")
+                               ? source.attr("__fspath__")().cast<std::string>()
+                               : source.cast<std::string>();
+        py::gil_scoped_release release;
+        return countline::count_file(path, options);
+    }
+    if (PyObject_CheckBuffer(source.ptr()))
+    {
+        return count_buffer(source, options.newline);
+    }
+    throw py::type_error("count_lines takes a path, a file descriptor or a buffer");
+}
+
+} /* end namespace */
+
+PYBIND11_MODULE(_countline, mod)
+{
+    mod.doc() = "Native SIMD line counting for countline.py";
+
+    // std::system_error carries the errno of the failed call.
+    py::register_exception_translator([](std::exception_ptr error)
+    {
+        try
+        {
+            if (error) { std::rethrow_exception(error); }
+        }
+        catch (std::system_error const & e)
+        {
+            py::tuple const args = py::make_tuple(e.code().value(), std::string(e.what()));
+            PyErr_SetObject(PyExc_OSError, args.ptr());
+        }
+    });
+
+    mod.def("count_lines", &count_lines, py::arg("source"), py::arg("mode") = "universal", py::arg("nthread") = 0,
+            "Return the number of lines in source: a path, an open file descriptor\n"
+            "(from its current offset), or a bytes-like object.\n\n"
+            "mode is 'universal' (\\n, \\r\\n and \\r end lines, like text-mode\n"
+            "readlines() on Python 3) or 'lf' (\\n only, like Python 2).  A final line\n"
+            "without a line end counts.  nthread=0 picks the number of threads from the\n"
+            "file size.  Raises OSError when the file cannot be read.");
+    mod.def("kernel", &countline::kernel_name, "Name of the SIMD kernel in use.");
+}
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,238 @@
+#include "stats.hpp"
+#include "fileio.hpp"
+
+#include <immintrin.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+namespace countline
+{
+
+namespace
+{
+
+using Masks = StatsCounter::Masks;
+
+constexpr size_t PIECE_SIZE = 32 << 10;
+
+/// Mask with the lowest nbit bits set.
+inline uint64_t low_bits(unsigned nbit)
+{
+    return nbit >= 64 ? ~uint64_t(0) : (uint64_t(1) << nbit) - 1;
+}
+
+inline bool is_space(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+Masks classify_scalar(char const * data, unsigned nbyte)
+{
+    Masks masks = {0, 0, 0};
+    for (unsigned it=0; it<nbyte; ++it)
+    {
+        unsigned char const c = static_cast<unsigned char>(data[it]);
+        masks.newline |= uint64_t(c == '\n') << it;
+        masks.space |= uint64_t(is_space(c)) << it;
+        masks.continuation |= uint64_t((c & 0xc0) == 0x80) << it;
+    }
+    return masks;
+}
+
+void update_scalar(StatsCounter & counter, char const * data, size_t size)
+{
+    for (size_t it=0; it<size; it+=64)
+    {
+        unsigned const nbyte = static_cast<unsigned>(std::min<size_t>(64, size - it));
+        counter.accumulate(classify_scalar(data + it, nbyte), nbyte);
+    }
+}
+
+/*
+ * Whitespace is found with one shuffle: indexed by the low nibble of a byte,
+ * the table holds the only whitespace byte with that nibble (" " for 0,
+ * "\t".."\r" for 9..13), and zero for nibbles no whitespace has.  A byte is
+ * whitespace exactly when it equals its table entry.
+ */
+#define COUNTLINE_SPACE_LUT \
+    0x20, 0, 0, 0, 0, 0, 0, 0, 0, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0, 0
+
+/// Classify 32 bytes into bits [shift, shift+32) of masks.
+__attribute__((target("avx2")))
+inline void classify_avx2(__m256i v, Masks & masks, unsigned shift)
+{
+    __m256i const lut = _mm256_setr_epi8(COUNTLINE_SPACE_LUT, COUNTLINE_SPACE_LUT);
+    __m256i const space = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, _mm256_set1_epi8(0x0f))), v);
+    __m256i const newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    // Continuation bytes are the ones below 0xc0 as signed bytes.
+    __m256i const continuation = _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v);
+    masks.newline |= uint64_t(uint32_t(_mm256_movemask_epi8(newline))) << shift;
+    masks.space |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << shift;
+    masks.continuation |= uint64_t(uint32_t(_mm256_movemask_epi8(continuation))) << shift;
+}
+
+__attribute__((target("avx2,bmi,popcnt")))
+void update_avx2(StatsCounter & counter, char const * data, size_t size)
+{
+    size_t it = 0;
+    for (; size - it >= 64; it += 64)
+    {
+        Masks masks = {0, 0, 0};
+        classify_avx2(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + it)), masks, 0);
+        classify_avx2(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + it + 32)), masks, 32);
+        counter.accumulate(masks, 64);
+    }
+    update_scalar(counter, data + it, size - it);
+}
+
+__attribute__((target("avx512f,avx512bw,bmi,bmi2,popcnt")))
+void update_avx512(StatsCounter & counter, char const * data, size_t size)
+{
+    alignas(64) static signed char const table[64] =
+    {
+        COUNTLINE_SPACE_LUT, COUNTLINE_SPACE_LUT, COUNTLINE_SPACE_LUT, COUNTLINE_SPACE_LUT,
+    };
+    __m512i const lut = _mm512_load_si512(table);
+    __m512i const nibble = _mm512_set1_epi8(0x0f);
+    __m512i const newline = _mm512_set1_epi8('\n');
+    __m512i const lead = _mm512_set1_epi8(-64);
+    for (size_t it=0; it<size; it+=64)
+    {
+        unsigned const nbyte = static_cast<unsigned>(std::min<size_t>(64, size - it));
+        __m512i const v = _mm512_maskz_loadu_epi8(_bzhi_u64(~0ULL, nbyte), data + it);
+        Masks masks;
+        masks.newline = _mm512_cmpeq_epi8_mask(v, newline);
+        masks.space = _mm512_cmpeq_epi8_mask(_mm512_shuffle_epi8(lut, _mm512_and_si512(v, nibble)), v);
+        masks.continuation = _mm512_cmplt_epi8_mask(v, lead);
+        counter.accumulate(masks, nbyte);
+    }
+}
+
+#undef COUNTLINE_SPACE_LUT
+
+using update_type = void (*)(StatsCounter &, char const *, size_t);
+
+update_type select_update()
+{
+    static update_type const update = []() -> update_type
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2"))
+        {
+            return update_avx512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        {
+            return update_avx2;
+        }
+        return update_scalar;
+    }();
+    return update;
+}
+
+} /* end namespace */
+
+StatsCounter::StatsCounter(unsigned fields, Newline newline)
+  : m_fields(fields), m_lines(newline)
+{}
+
+void StatsCounter::update(char const * data, size_t size)
+{
+    if ((m_fields & ~(STAT_LINES | STAT_BYTES)) == 0)
+    {
+        // Lines and bytes only: the line counter is all it takes.
+        m_lines.update(data, size);
+    }
+    else
+    {
+        // Classify each piece while the line counter left it in cache.
+        for (size_t it=0; it<size; it+=PIECE_SIZE)
+        {
+            size_t const length = std::min(PIECE_SIZE, size - it);
+            m_lines.update(data + it, length);
+            select_update()(*this, data + it, length);
+        }
+    }
+    m_stats.bytes += size;
+}
+
+void StatsCounter::accumulate(Masks const & masks, unsigned nbyte)
+{
+    uint64_t const valid = low_bits(nbyte);
+    uint64_t const newline = masks.newline & valid;
+    if (m_fields & STAT_WORDS)
+    {
+        // A word starts at a non-space byte that follows a space.
+        uint64_t const after_space = (masks.space << 1) | (m_prev_space ? 1 : 0);
+        m_stats.words += static_cast<size_t>(__builtin_popcountll(~masks.space & after_space & valid));
+        m_prev_space = (masks.space >> (nbyte - 1)) & 1;
+    }
+    uint64_t chars = ~masks.continuation & valid;
+    if (m_fields & STAT_CHARS)
+    {
+        m_stats.chars += static_cast<size_t>(__builtin_popcountll(chars));
+    }
+    if (m_fields & STAT_MAX_LINE)
+    {
+        chars &= ~newline;
+        unsigned begin = 0;
+        for (uint64_t rest = newline; rest; rest &= rest - 1)
+        {
+            unsigned const end = static_cast<unsigned>(__builtin_ctzll(rest));
+            m_line_chars += static_cast<size_t>(__builtin_popcountll(chars & low_bits(end) & ~low_bits(begin)));
+            m_stats.max_line = std::max(m_stats.max_line, m_line_chars);
+            m_line_chars = 0;
+            begin = end + 1;
+        }
+        m_line_chars += static_cast<size_t>(__builtin_popcountll(chars & ~low_bits(begin)));
+    }
+}
+
+TextStats StatsCounter::stats() const
+{
+    TextStats stats = m_stats;
+    stats.lines = m_lines.lines();
+    stats.max_line = std::max(stats.max_line, m_line_chars);
+    return stats;
+}
+
+TextStats count_stats_fd(int fd, unsigned fields, Newline newline)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { throw_errno("fstat"); }
+
+    StatsCounter counter(fields, newline);
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        Mapping const mapping(fd, static_cast<size_t>(st.st_size));
+        if (mapping)
+        {
+            counter.update(mapping.data(), mapping.size());
+            return counter.stats();
+        }
+    }
+
+    std::unique_ptr<char, decltype(&std::free)> buffer(
+        static_cast<char *>(std::aligned_alloc(4096, STREAM_BUFFER_SIZE)), &std::free);
+    if (!buffer) { throw std::bad_alloc(); }
+    for (;;)
+    {
+        ssize_t const nread = ::read(fd, buffer.get(), STREAM_BUFFER_SIZE);
+        if (nread < 0)
+        {
+            if (errno == EINTR) { continue; }
+            throw_errno("read");
+        }
+        if (nread == 0) { break; }
+        counter.update(buffer.get(), static_cast<size_t>(nread));
+    }
+    return counter.stats();
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
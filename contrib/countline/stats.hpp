@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+ * wc-style statistics computed in one pass over the data.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace countline
+{
+
+/// Bit flags selecting the statistics StatsCounter computes.
+enum StatField : unsigned
+{
+    STAT_LINES = 1U << 0,
+    STAT_WORDS = 1U << 1,
+    STAT_CHARS = 1U << 2,
+    STAT_BYTES = 1U << 3,
+    STAT_MAX_LINE = 1U << 4,
+}; /* end enum StatField */
+
+struct TextStats
+{
+    /// Lines as countline.py counts them (a final unterminated line counts).
+    size_t lines = 0;
+    /// Maximal runs of bytes other than ASCII whitespace (" \t\n\v\f\r").
+    size_t words = 0;
+    /// UTF-8 characters: bytes that are not continuation bytes (0x80-0xbf).
+    size_t chars = 0;
+    size_t bytes = 0;
+    /// Characters in the longest line, excluding the newline; lines are
+    /// split at "\n" only, like wc -L.
+    size_t max_line = 0;
+}; /* end struct TextStats */
+
+/**
+ * Accumulate statistics of a byte stream fed in arbitrary pieces.
+ *
+ * Each 64-byte block is classified with vector compares and a nibble shuffle
+ * (AVX-512BW or AVX2, selected at run time) into newline, whitespace and
+ * continuation-byte bit masks, from which the statistics follow with
+ * popcounts.  Only the longest line needs a walk over the newline positions,
+ * and only when STAT_MAX_LINE is requested.  Lines are counted by a
+ * LineCounter over the same pieces, so they follow the Newline mode.
+ */
+class StatsCounter
+{
+public:
+    explicit StatsCounter(unsigned fields, Newline newline = Newline::universal);
+
+    void update(char const * data, size_t size);
+    TextStats stats() const;
+
+    /// Classification of up to 64 bytes, one bit per byte.
+    struct Masks
+    {
+        uint64_t newline;
+        uint64_t space;
+        uint64_t continuation;
+    }; /* end struct Masks */
+
+    /// Fold a block of nbyte (<= 64) classified bytes into the statistics.
+    void accumulate(Masks const & masks, unsigned nbyte);
+
+private:
+    unsigned m_fields;
+    LineCounter m_lines;
+    TextStats m_stats;
+    size_t m_line_chars = 0;
+    bool m_prev_space = true;
+}; /* end class StatsCounter */
+
+/**
+ * Compute the requested statistics of the input on fd: regular files are
+ * mapped, anything else is streamed.  Throws std::system_error on failure.
+ */
+TextStats count_stats_fd(int fd, unsigned fields, Newline newline = Newline::universal);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
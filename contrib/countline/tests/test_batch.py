@@ -0,0 +1,62 @@
+# Batch records: run with "make test".
+
+import base64
+import json
+import os
+import subprocess
+
+import pytest
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+COUNTLINE = os.path.join(HERE, '..', 'countline')
+
+VALID = [
+    b'plain',
+    'caf\u00e9'.encode(),
+    '\u20ac\U0010ffff'.encode(),
+    b'quote"back\\slash',
+    b'tab\tnewline\n',
+]
+INVALID = [
+    b'latin1-\xe9',
+    b'overlong-\xc0\xaf',
+    b'overlong-\xe0\x80\xaf',
+    b'overlong-\xf0\x80\x80\xaf',
+    b'surrogate-\xed\xa0\x80',
+    b'above-\xf4\x90\x80\x80',
+    b'truncated-\xe2\x82',
+    # Looks like the escape the old format wrote for \xe9.
+    b'\\u00e9-\xe9',
+]
+
+
+def batch(tmp_path, names):
+    paths = []
+    for it, name in enumerate(names):
+        directory = os.path.join(bytes(tmp_path), b'%d' % it)
+        os.mkdir(directory)
+        path = os.path.join(directory, name)
+        with open(path, 'wb') as fobj:
+            fobj.write(b'a\n' * it)
+        paths.append(path)
+    out = subprocess.run([COUNTLINE, '--batch', '-0'], input=b'\0'.join(paths),
+                         stdout=subprocess.PIPE, check=True)
+    return paths, [json.loads(line) for line in out.stdout.splitlines()]
+
+
+@pytest.mark.parametrize('names', [VALID, INVALID], ids=['valid', 'invalid'])
+def test_paths_round_trip(tmp_path, names):
+    paths, records = batch(tmp_path, names)
+    assert len(records) == len(paths)
+    for it, (path, record) in enumerate(zip(paths, records)):
+        if names is VALID:
+            assert 'path_b64' not in record
+            assert record['path'].encode() == path
+        else:
+            assert 'path' not in record
+            assert base64.b64decode(record['path_b64']) == path
+        assert record['lines'] == it
+        assert record['error'] is None
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
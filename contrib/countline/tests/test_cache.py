@@ -0,0 +1,66 @@
+# The incremental cache: run with "make test".
+
+import glob
+import os
+import resource
+import signal
+import subprocess
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+COUNTLINE = os.path.join(HERE, '..', 'countline')
+
+MAX_ENTRIES = 65536
+
+
+def write_cache(path, nentry):
+    # Entries of files that do not exist, each used at a different time.
+    lines = ['countline-cache 2']
+    lines += ['1 {} 10 0 1 10 u 0 {}'.format(it, it) for it in range(nentry)]
+    path.write_text('\n'.join(lines) + '\n')
+
+
+def test_evicts_down_to_limit(tmp_path):
+    cache = tmp_path / 'cache'
+    nentry = MAX_ENTRIES + 5000
+    write_cache(cache, nentry)
+    log = tmp_path / 'log'
+    log.write_bytes(b'a\nb\n')
+    out = subprocess.run([COUNTLINE, '--cache=' + str(cache), str(log)], stdout=subprocess.PIPE, check=True)
+    assert out.stdout.startswith(b'2 lines in')
+    kept = cache.read_text().splitlines()[1:]
+    assert len(kept) == MAX_ENTRIES
+    # The oldest went, and the entry just written stayed.
+    used = sorted(int(line.split()[-1]) for line in kept)
+    assert used[0] == nentry - MAX_ENTRIES + 1
+    assert any(line.split()[1] == str(os.stat(str(log)).st_ino) for line in kept)
+
+
+def limit_file_size():
+    signal.signal(signal.SIGXFSZ, signal.SIG_IGN)
+    resource.setrlimit(resource.RLIMIT_FSIZE, (64 << 10, 64 << 10))
+
+
+def test_failed_write_leaves_no_temporary(tmp_path):
+    cache = tmp_path / 'cache'
+    write_cache(cache, 10000)
+    log = tmp_path / 'log'
+    log.write_bytes(b'a\n')
+    out = subprocess.run([COUNTLINE, '--cache=' + str(cache), str(log)], stdout=subprocess.PIPE,
+                         stderr=subprocess.PIPE, preexec_fn=limit_file_size)
+    assert out.returncode != 0
+    assert glob.glob(str(cache) + '.tmp.*') == []
+    assert len(cache.read_text().splitlines()) == 10001
+
+
+def test_failed_rename_leaves_no_temporary(tmp_path):
+    # A directory where the cache should be: the rename over it fails.
+    cache = tmp_path / 'cache'
+    cache.mkdir()
+    log = tmp_path / 'log'
+    log.write_bytes(b'a\n')
+    out = subprocess.run([COUNTLINE, '--cache=' + str(cache), str(log)], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    assert out.returncode != 0
+    assert glob.glob(str(cache) + '.tmp.*') == []
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,69 @@
+# Counting compressed input: run with "make test".
+
+import gzip
+import os
+import random
+import subprocess
+import zlib
+
+import pytest
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+COUNTLINE = os.path.join(HERE, '..', 'countline')
+# Feeds zlib 4093 bytes at a time (make countline-slice).
+COUNTLINE_SLICE = os.path.join(HERE, '..', 'countline-slice')
+
+GIB = 1 << 30
+
+
+def count(binary, path):
+    out = subprocess.run([binary, '-z', '--newline=lf', path], stdout=subprocess.PIPE, check=True)
+    return int(out.stdout.split()[0])
+
+
+def text(rng, nline):
+    return b''.join(b'x' * rng.randrange(200) + b'\n' for _ in range(nline))
+
+
+@pytest.mark.parametrize('binary', [COUNTLINE, COUNTLINE_SLICE])
+def test_gzip_members_across_slices(tmp_path, binary):
+    rng = random.Random(56)
+    # Members of random sizes, so that their ends fall anywhere in a slice,
+    # and stored blocks, which zlib cannot shrink below the slice size.
+    pieces = [text(rng, rng.randrange(1, 2000)) for _ in range(7)]
+    data = b''.join(gzip.compress(piece, compresslevel=rng.choice([0, 1, 9])) for piece in pieces)
+    path = tmp_path / 'members.gz'
+    path.write_bytes(data)
+    assert count(binary, str(path)) == sum(piece.count(b'\n') for piece in pieces)
+
+
+@pytest.mark.parametrize('binary', [COUNTLINE, COUNTLINE_SLICE])
+def test_gzip_corrupt_across_slices(tmp_path, binary):
+    data = gzip.compress(text(random.Random(1), 5000), compresslevel=0)
+    path = tmp_path / 'truncated.gz'
+    path.write_bytes(data[:len(data) - 10000])
+    out = subprocess.run([binary, '-z', str(path)], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    assert b'lines in' not in out.stdout
+
+
+@pytest.mark.skipif(not os.environ.get('COUNTLINE_TEST_LARGE'),
+                    reason='writes a 4.1 GiB file; set COUNTLINE_TEST_LARGE=1')
+def test_gzip_over_4gib(tmp_path):
+    # Stored blocks keep the compressed file as large as its content, so
+    # the single frame handed to zlib is above 4 GiB.
+    rng = random.Random(4)
+    block = bytes(rng.getrandbits(8) for _ in range(1 << 20))
+    compressor = zlib.compressobj(0, zlib.DEFLATED, 16 + zlib.MAX_WBITS)
+    path = tmp_path / 'large.gz'
+    lines = 0
+    with open(path, 'wb') as fobj:
+        for _ in range((4 * GIB + 256 * (1 << 20)) // len(block)):
+            lines += block.count(b'\n')
+            fobj.write(compressor.compress(block))
+        fobj.write(compressor.flush())
+    assert os.path.getsize(path) > 4 * GIB
+    # The last block does not end with a newline: the final line counts.
+    assert count(COUNTLINE, str(path)) == lines + (block[-1:] != b'\n')
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
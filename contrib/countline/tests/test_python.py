@@ -0,0 +1,140 @@
+# countline.py, the _countline extension and the native binary run as
+# countline.py agree: run with "make test".  The extension is built with
+# "make python"; its tests are skipped when that fails (no pybind11), unless
+# COUNTLINE_TEST_EXTENSION is set.
+
+import importlib
+import os
+import random
+import re
+import subprocess
+import sys
+
+import pytest
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.dirname(HERE)
+COUNTLINE = os.path.join(SOURCE, 'countline')
+SCRIPT = os.path.join(SOURCE, 'countline.py')
+
+LINE_END_RE = re.compile(rb'\r\n|\r|\n')
+
+sys.path.insert(0, SOURCE)
+
+
+def contents():
+    rng = random.Random(61)
+    ends = [b'\n', b'\r\n', b'\r']
+    yield 'empty', b''
+    yield 'no-newline', b'one line'
+    yield 'lf', b'a\nb\n'
+    yield 'crlf', b'a\r\nb\r\n'
+    yield 'cr', b'a\rb\r'
+    yield 'crlf-split', b'\r' + b'\n' * 3 + b'\r'
+    # Mixed line ends across several chunks of the engine.
+    yield 'mixed', b''.join(b'x' * rng.randrange(80) + rng.choice(ends) for _ in range(200000)) + b'tail'
+
+
+@pytest.fixture(scope='module')
+def files(tmp_path_factory):
+    directory = tmp_path_factory.mktemp('python')
+    paths = []
+    for name, data in contents():
+        path = directory / name
+        path.write_bytes(data)
+        paths.append(str(path))
+    return paths
+
+
+@pytest.fixture(scope='module')
+def extension():
+    build = subprocess.run(['make', '-s', '-C', SOURCE, 'python', 'PYTHON=' + sys.executable],
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    if build.returncode != 0:
+        message = 'cannot build _countline (is pybind11 installed?)'
+        if os.environ.get('COUNTLINE_TEST_EXTENSION'):
+            pytest.fail(message + '\n' + build.stdout.decode(errors='replace'))
+        pytest.skip(message)
+    return importlib.import_module('_countline')
+
+
+def run(argv, env=None):
+    return subprocess.run(argv, stdout=subprocess.PIPE, env=env, check=True).stdout
+
+
+def cli_count(path, mode='universal'):
+    out = run([COUNTLINE, '--newline=' + mode, path])
+    return int(out.split()[0])
+
+
+def test_script_matches_cli(files):
+    for path in files:
+        assert run([sys.executable, SCRIPT, path]) == run([COUNTLINE, path])
+
+
+def test_count_matches_cli(files):
+    # With the extension when it was built, by iterating the file otherwise.
+    import countline
+    for path in files:
+        assert countline.count(path) == cli_count(path)
+
+
+def test_extension_matches_cli(files, extension):
+    import countline
+    importlib.reload(countline)
+    assert countline.count_lines is extension.count_lines
+    for path in files:
+        assert countline.count(path) == cli_count(path)
+        for mode in ('universal', 'lf'):
+            expected = cli_count(path, mode)
+            assert extension.count_lines(path, mode=mode) == expected
+            with open(path, 'rb') as fobj:
+                assert extension.count_lines(fobj.fileno(), mode=mode) == expected
+                fobj.seek(0)
+                assert extension.count_lines(memoryview(fobj.read()), mode=mode) == expected
+
+
+def remainders(files):
+    """(path, offset, count of the bytes after offset) for a few offsets."""
+    for path in files:
+        with open(path, 'rb') as fobj:
+            data = fobj.read()
+        for offset in sorted({1, 2, len(data) // 2, len(data) - 1}):
+            if 0 < offset < len(data):
+                rest = data[offset:]
+                yield path, offset, len(LINE_END_RE.findall(rest)) + (not rest.endswith((b'\n', b'\r')))
+
+
+def test_stdin_counts_from_offset(files):
+    # A file read partly already, such as the standard input of
+    # "{ read header; countline -; } < file", is counted from its offset.
+    for path, offset, expected in remainders(files):
+        with open(path, 'rb') as fobj:
+            fobj.seek(offset)
+            out = subprocess.run([COUNTLINE, '-'], stdin=fobj, stdout=subprocess.PIPE, check=True).stdout
+        assert int(out.split()[0]) == expected
+
+
+def test_extension_counts_from_offset(files, extension):
+    for path, offset, expected in remainders(files):
+        with open(path, 'rb', buffering=0) as fobj:
+            fobj.read(offset)
+            assert extension.count_lines(fobj.fileno()) == expected
+
+
+@pytest.mark.parametrize('args', [[], ['{0}'], ['{0}', '{0}'], ['missing'], ['-'], ['-j2']],
+                         ids=['none', 'file', 'two', 'missing', 'dash', 'option'])
+def test_binary_as_script(tmp_path, monkeypatch, files, args):
+    # The native binary started under a name ending in .py, directly and
+    # through the bash wrapper of countline.py, behaves as countline.py.
+    monkeypatch.chdir(str(tmp_path))
+    args = [arg.format(files[-1]) for arg in args]
+    link = str(tmp_path / 'countline.py')
+    os.symlink(COUNTLINE, link)
+    expected = run([sys.executable, SCRIPT] + args)
+    assert run([link] + args) == expected
+    env = dict(os.environ, COUNTLINE_BIN=COUNTLINE)
+    assert run([SCRIPT] + args, env=env) == expected
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,66 @@
+# Watching files: run with "make test".
+
+import os
+import select
+import signal
+import subprocess
+import time
+
+import pytest
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+COUNTLINE = os.path.join(HERE, '..', 'countline')
+
+
+class Watch:
+    """countline --watch printing its changes, read line by line."""
+
+    def __init__(self, args, cwd):
+        self.process = subprocess.Popen([COUNTLINE, '--watch'] + args, cwd=cwd, stdout=subprocess.PIPE)
+        self.pending = b''
+
+    def expect(self, text, timeout=5.0):
+        deadline = time.monotonic() + timeout
+        while text.encode() + b'\n' not in self.pending:
+            left = deadline - time.monotonic()
+            assert left > 0, 'no {!r} in {!r}'.format(text, self.pending)
+            if select.select([self.process.stdout], [], [], left)[0]:
+                self.pending += os.read(self.process.stdout.fileno(), 65536)
+        self.pending = self.pending.split(text.encode() + b'\n', 1)[1]
+
+    def stop(self):
+        self.process.send_signal(signal.SIGTERM)
+        assert self.process.wait(5) == 0
+
+
+@pytest.fixture
+def logs(tmp_path):
+    directory = tmp_path / 'logs'
+    directory.mkdir()
+    for name in ('a.log', 'b.log'):
+        (directory / name).write_bytes(b'line\n')
+    return os.path.realpath(str(directory))
+
+
+@pytest.mark.parametrize('args', [
+    ['logs/a.log', './logs/b.log'],
+    ['logs/a.log', 'logs/../logs/'],
+    ['./logs', 'logs/b.log'],
+], ids=['two-files', 'file-and-directory', 'directory-and-file'])
+def test_one_directory_two_spellings(logs, args):
+    watch = Watch(args, os.path.dirname(logs))
+    try:
+        watch.expect('1 lines in {}/a.log'.format(logs))
+        watch.expect('1 lines in {}/b.log'.format(logs))
+        for name, nline in (('b.log', 3), ('a.log', 4)):
+            with open(os.path.join(logs, name), 'ab') as fobj:
+                fobj.write(b'more\n' * (nline - 1))
+            watch.expect('{} lines in {}/{}'.format(nline, logs, name))
+    finally:
+        watch.stop()
+    # No file was followed under a second name.
+    for line in watch.pending.splitlines():
+        assert line.split(b' lines in ', 1)[1].startswith(logs.encode() + b'/')
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,96 @@
+#include "unixsocket.hpp"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <cstring>
+#include <system_error>
+
+namespace countline
+{
+
+namespace
+{
+
+struct sockaddr_un make_address(std::string const & path)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::system_error(path.empty() ? ENOENT : ENAMETOOLONG, std::generic_category(), path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return addr;
+}
+
+} /* end namespace */
+
+std::unique_ptr<Descriptor> listen_unix(std::string const & path)
+{
+    struct sockaddr_un const addr = make_address(path);
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode)) { throw std::system_error(EEXIST, std::generic_category(), path); }
+        ::unlink(path.c_str());
+    }
+    std::unique_ptr<Descriptor> sock(new Descriptor(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), "socket"));
+    if (::bind(sock->fd(), reinterpret_cast<struct sockaddr const *>(&addr), sizeof(addr)) != 0
+        || ::listen(sock->fd(), 128) != 0)
+    {
+        throw_errno(path);
+    }
+    return sock;
+}
+
+std::unique_ptr<Descriptor> connect_unix(std::string const & path)
+{
+    struct sockaddr_un const addr = make_address(path);
+    std::unique_ptr<Descriptor> sock(new Descriptor(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), "socket"));
+    while (::connect(sock->fd(), reinterpret_cast<struct sockaddr const *>(&addr), sizeof(addr)) != 0)
+    {
+        if (errno != EINTR) { throw_errno(path); }
+    }
+    return sock;
+}
+
+void set_io_timeout(int fd, unsigned seconds)
+{
+    struct timeval const timeout = {static_cast<time_t>(seconds), 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+bool send_all(int fd, std::string const & data)
+{
+    for (size_t done = 0; done < data.size(); )
+    {
+        ssize_t const nsent = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (nsent < 0 && errno == EINTR) { continue; }
+        if (nsent <= 0) { return false; }
+        done += static_cast<size_t>(nsent);
+    }
+    return true;
+}
+
+bool recv_all(int fd, std::string & data, size_t limit)
+{
+    char buffer[4096];
+    for (;;)
+    {
+        ssize_t const nread = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (nread < 0 && errno == EINTR) { continue; }
+        if (nread < 0) { return false; }
+        if (nread == 0) { return true; }
+        data.append(buffer, static_cast<size_t>(nread));
+        if (data.size() > limit) { return false; }
+    }
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
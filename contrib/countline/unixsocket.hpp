@@ -0,0 +1,40 @@
+#pragma once
+
+/*
+ * Unix domain stream sockets for the watch and daemon modes.
+ */
+
+#include "fileio.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace countline
+{
+
+/**
+ * Listen on a Unix stream socket bound to path.  A socket left there by an
+ * earlier run is replaced, but any other file makes it fail with EEXIST.
+ * Throws std::system_error.
+ */
+std::unique_ptr<Descriptor> listen_unix(std::string const & path);
+
+/// Connect to the Unix stream socket at path.  Throws std::system_error.
+std::unique_ptr<Descriptor> connect_unix(std::string const & path);
+
+/// Make blocking send() and recv() on a socket give up after seconds.
+void set_io_timeout(int fd, unsigned seconds);
+
+/// Send all of data; false when the peer went away or the send timed out.
+bool send_all(int fd, std::string const & data);
+
+/**
+ * Receive until the peer shuts down its side; false on an error, a timeout,
+ * or more than limit bytes.
+ */
+bool recv_all(int fd, std::string & data, size_t limit);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,392 @@
+#include "uring.hpp"
+#include "countline.hpp"
+#include "fileio.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <system_error>
+
+namespace countline
+{
+
+namespace
+{
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params * params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void const * arg, unsigned nr_args)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/// Minimal owner of an io_uring instance: submission and completion rings.
+class Ring
+{
+public:
+
+    explicit Ring(unsigned entries)
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_fd = sys_io_uring_setup(entries, &params);
+        if (m_fd < 0) { throw_errno("io_uring_setup"); }
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        }
+        m_sq_ptr = ::mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ptr == MAP_FAILED) { cleanup(); throw_errno("mmap"); }
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            m_cq_ptr = m_sq_ptr;
+        }
+        else
+        {
+            m_cq_ptr = ::mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ptr == MAP_FAILED) { m_cq_ptr = nullptr; cleanup(); throw_errno("mmap"); }
+        }
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void * sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { cleanup(); throw_errno("mmap"); }
+        m_sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+        char * sq = static_cast<char *>(m_sq_ptr);
+        m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        char * cq = static_cast<char *>(m_cq_ptr);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    Ring(Ring const & ) = delete;
+    Ring & operator=(Ring const & ) = delete;
+    ~Ring() { cleanup(); }
+
+    /// Register buffers for fixed reads; false if the kernel refuses (e.g.
+    /// RLIMIT_MEMLOCK is too small).
+    bool register_buffers(struct iovec const * iovecs, unsigned count)
+    {
+        return sys_io_uring_register(m_fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+    }
+
+    /// Next free submission entry (zeroed), or nullptr when the ring is full.
+    struct io_uring_sqe * get_sqe()
+    {
+        unsigned const head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sq_local_tail - head >= m_sq_entries) { return nullptr; }
+        unsigned const index = m_sq_local_tail & m_sq_mask;
+        struct io_uring_sqe * sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        ++m_sq_local_tail;
+        ++m_to_submit;
+        return sqe;
+    }
+
+    /// Publish queued entries and wait until at least min_complete complete.
+    void submit_and_wait(unsigned min_complete)
+    {
+        __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+        unsigned const flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+        for (;;)
+        {
+            int const ret = sys_io_uring_enter(m_fd, m_to_submit, min_complete, flags);
+            if (ret >= 0)
+            {
+                m_to_submit -= std::min(m_to_submit, static_cast<unsigned>(ret));
+                return;
+            }
+            if (errno != EINTR) { throw_errno("io_uring_enter"); }
+        }
+    }
+
+    /// Call func on every available completion and consume them.
+    template <typename F>
+    void reap(F && func)
+    {
+        unsigned head = *m_cq_head;
+        unsigned const tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            func(m_cqes[head & m_cq_mask]);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+
+    void cleanup()
+    {
+        if (m_sqes) { ::munmap(m_sqes, m_sqes_size); }
+        if (m_cq_ptr && m_cq_ptr != m_sq_ptr && m_cq_ptr != MAP_FAILED) { ::munmap(m_cq_ptr, m_cq_size); }
+        if (m_sq_ptr && m_sq_ptr != MAP_FAILED) { ::munmap(m_sq_ptr, m_sq_size); }
+        if (m_fd >= 0) { ::close(m_fd); }
+        m_sqes = nullptr;
+        m_cq_ptr = m_sq_ptr = nullptr;
+        m_fd = -1;
+    }
+
+    int m_fd = -1;
+    void * m_sq_ptr = nullptr;
+    void * m_cq_ptr = nullptr;
+    size_t m_sq_size = 0;
+    size_t m_cq_size = 0;
+    size_t m_sqes_size = 0;
+    struct io_uring_sqe * m_sqes = nullptr;
+    unsigned * m_sq_head = nullptr;
+    unsigned * m_sq_tail = nullptr;
+    unsigned * m_sq_array = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned m_sq_entries = 0;
+    unsigned m_sq_local_tail = 0;
+    unsigned m_to_submit = 0;
+    unsigned * m_cq_head = nullptr;
+    unsigned * m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    struct io_uring_cqe * m_cqes = nullptr;
+}; /* end class Ring */
+
+struct FileState
+{
+    int fd = -1;
+    size_t size = 0;
+    size_t next = 0; // offset of the next read to submit
+    unsigned inflight = 0;
+    size_t newlines = 0;
+    char last = '\n';
+    // Buffers complete out of order: the offsets where one ends with "\r"
+    // and where one starts with "\n" tell the "\r\n" split between two.
+    std::vector<size_t> cr_ends;
+    std::vector<size_t> lf_starts;
+}; /* end struct FileState */
+
+/// A read occupying one buffer.
+struct Request
+{
+    size_t file;
+    size_t offset;
+    size_t length;
+}; /* end struct Request */
+
+/// A request to resubmit after a short or interrupted read.
+struct Retry
+{
+    unsigned buffer;
+    size_t done; // bytes already in the buffer
+}; /* end struct Retry */
+
+} /* end namespace */
+
+bool uring_available()
+{
+    try
+    {
+        Ring ring(1);
+        return true;
+    }
+    catch (std::system_error const & )
+    {
+        return false;
+    }
+}
+
+std::vector<FileCount> count_files_uring(std::vector<std::string> const & paths, UringOptions const & options)
+{
+    unsigned const depth = std::max(1U, options.queue_depth);
+    size_t const bufsize = std::max<size_t>(4096, options.buffer_size);
+    size_t const max_open = 2 * static_cast<size_t>(depth);
+
+    Ring ring(depth);
+
+    std::unique_ptr<char, decltype(&std::free)> pool(
+        static_cast<char *>(std::aligned_alloc(4096, bufsize * depth)), &std::free);
+    if (!pool) { throw std::bad_alloc(); }
+    std::vector<struct iovec> iovecs(depth);
+    for (unsigned it=0; it<depth; ++it)
+    {
+        iovecs[it].iov_base = pool.get() + it * bufsize;
+        iovecs[it].iov_len = bufsize;
+    }
+    bool const fixed = ring.register_buffers(iovecs.data(), depth);
+
+    std::vector<FileCount> counts(paths.size());
+    std::vector<FileState> states(paths.size());
+    std::vector<Request> requests(depth);
+    std::vector<unsigned> free_buffers;
+    for (unsigned it=depth; it>0; --it) { free_buffers.push_back(it - 1); }
+    std::deque<size_t> active; // opened files with reads left to submit
+    std::deque<Retry> retries;
+    size_t next_path = 0;
+    size_t nopen = 0;
+    unsigned inflight = 0;
+
+    auto finish = [&](size_t ifile, int error)
+    {
+        FileState & state = states[ifile];
+        if (state.fd >= 0)
+        {
+            ::close(state.fd);
+            state.fd = -1;
+            --nopen;
+        }
+        counts[ifile].path = paths[ifile];
+        counts[ifile].error = error;
+        std::sort(state.cr_ends.begin(), state.cr_ends.end());
+        std::sort(state.lf_starts.begin(), state.lf_starts.end());
+        std::vector<size_t> split;
+        std::set_intersection(state.cr_ends.begin(), state.cr_ends.end(),
+                              state.lf_starts.begin(), state.lf_starts.end(), std::back_inserter(split));
+        counts[ifile].lines = error ? 0 : state.newlines - split.size() + (is_line_end(state.last, options.newline) ? 0 : 1);
+    };
+
+    auto open_next = [&]()
+    {
+        size_t const ifile = next_path++;
+        FileState & state = states[ifile];
+        state.fd = ::open(paths[ifile].c_str(), O_RDONLY | O_CLOEXEC);
+        if (state.fd < 0)
+        {
+            finish(ifile, errno);
+            return;
+        }
+        ++nopen;
+        struct stat st;
+        if (::fstat(state.fd, &st) != 0) { finish(ifile, errno); return; }
+        if (!S_ISREG(st.st_mode)) { finish(ifile, S_ISDIR(st.st_mode) ? EISDIR : EINVAL); return; }
+        state.size = static_cast<size_t>(st.st_size);
+        if (state.size == 0) { finish(ifile, 0); return; }
+        active.push_back(ifile);
+    };
+
+    auto submit = [&](unsigned ibuf, Request const & request, size_t skip)
+    {
+        struct io_uring_sqe * sqe = ring.get_sqe();
+        sqe->fd = states[request.file].fd;
+        sqe->off = request.offset + skip;
+        sqe->addr = reinterpret_cast<unsigned long long>(pool.get() + ibuf * bufsize + skip);
+        sqe->len = static_cast<unsigned>(request.length - skip);
+        sqe->user_data = (static_cast<unsigned long long>(skip) << 32) | ibuf;
+        if (fixed)
+        {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->buf_index = static_cast<unsigned short>(ibuf);
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_READ;
+        }
+        ++inflight;
+    };
+
+    for (;;)
+    {
+        // Keep every buffer busy: resubmit short reads first, then read ahead
+        // in the open files, then open more files.  Each read in flight holds
+        // a buffer, so the submission queue cannot overflow.
+        while (!retries.empty())
+        {
+            Retry const retry = retries.front();
+            retries.pop_front();
+            submit(retry.buffer, requests[retry.buffer], retry.done);
+        }
+        while (!free_buffers.empty())
+        {
+            if (active.empty())
+            {
+                if (next_path < paths.size() && nopen < max_open) { open_next(); continue; }
+                break;
+            }
+            size_t const ifile = active.front();
+            FileState & state = states[ifile];
+            unsigned const ibuf = free_buffers.back();
+            free_buffers.pop_back();
+            requests[ibuf] = Request{ifile, state.next, std::min(bufsize, state.size - state.next)};
+            state.next += requests[ibuf].length;
+            ++state.inflight;
+            if (state.next >= state.size) { active.pop_front(); }
+            submit(ibuf, requests[ibuf], 0);
+        }
+        if (inflight == 0) { break; }
+
+        ring.submit_and_wait(1);
+        ring.reap([&](struct io_uring_cqe const & cqe)
+        {
+            --inflight;
+            unsigned const ibuf = static_cast<unsigned>(cqe.user_data & 0xffffffffU);
+            size_t const skip = static_cast<size_t>(cqe.user_data >> 32);
+            Request const & request = requests[ibuf];
+            FileState & state = states[request.file];
+            size_t const filled = skip + static_cast<size_t>(std::max(0, cqe.res));
+            if (cqe.res > 0 && filled < request.length)
+            {
+                retries.push_back(Retry{ibuf, filled});
+                return;
+            }
+            if (cqe.res < 0 && (cqe.res == -EAGAIN || cqe.res == -EINTR))
+            {
+                retries.push_back(Retry{ibuf, skip});
+                return;
+            }
+            char const * data = pool.get() + ibuf * bufsize;
+            if (cqe.res >= 0 && filled > 0)
+            {
+                state.newlines += count_line_ends(data, filled, options.newline);
+                if (request.offset + filled == state.size) { state.last = data[filled - 1]; }
+                if (options.newline == Newline::universal)
+                {
+                    if (data[0] == '\n' && request.offset) { state.lf_starts.push_back(request.offset); }
+                    if (data[filled - 1] == '\r') { state.cr_ends.push_back(request.offset + filled); }
+                }
+            }
+            --state.inflight;
+            free_buffers.push_back(ibuf);
+            if (cqe.res < 0)
+            {
+                // Stop reading a failed file; it is finished when its other
+                // reads drain.
+                state.next = state.size;
+                active.erase(std::remove(active.begin(), active.end(), request.file), active.end());
+                counts[request.file].error = -cqe.res;
+            }
+            if (state.next >= state.size && state.inflight == 0)
+            {
+                finish(request.file, counts[request.file].error);
+            }
+        });
+    }
+    return counts;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * io_uring backend for counting many files.
+ *
+ * The ring is driven with the raw system calls from <linux/io_uring.h>, so no
+ * liburing is needed.  On kernels (or sandboxes) without io_uring the callers
+ * fall back to pread().
+ */
+
+#include "countline.hpp"
+#include "walk.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace countline
+{
+
+struct UringOptions
+{
+    /// Number of reads kept in flight; also the number of buffers.
+    unsigned queue_depth = 128;
+    /// Size of each registered buffer.
+    size_t buffer_size = 64 << 10;
+    /// What ends a line.
+    Newline newline = Newline::universal;
+}; /* end struct UringOptions */
+
+/// Whether this process may create an io_uring instance.
+bool uring_available();
+
+/**
+ * Count the lines of the regular files at paths through one io_uring.
+ *
+ * Reads from many files are kept in flight at once into a pool of buffers
+ * registered with the kernel, and completed buffers are counted while the
+ * remaining reads proceed.  A file is counted up to the size it has when it is
+ * opened.  The result is in the order of paths.  Throws std::system_error if
+ * the ring cannot be set up.
+ */
+std::vector<FileCount> count_files_uring(std::vector<std::string> const & paths, UringOptions const & options = UringOptions());
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,336 @@
+#include "walk.hpp"
+#include "cache.hpp"
+#include "countline.hpp"
+#include "uring.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+namespace countline
+{
+
+namespace
+{
+
+struct Task
+{
+    size_t root; // index of the argument the task originates from
+    std::string path;
+    bool directory;
+    bool regular; // a regular file, which the io_uring backend can read
+}; /* end struct Task */
+
+struct Entry
+{
+    size_t root;
+    FileCount count;
+    bool deferred; // found by the walk but left for the io_uring backend
+}; /* end struct Entry */
+
+/// Task deque owned by one worker; the owner works at the back, thieves take
+/// from the front.
+class TaskDeque
+{
+public:
+    void push(Task && task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    bool pop(Task & task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tasks.empty()) { return false; }
+        task = std::move(m_tasks.back());
+        m_tasks.pop_back();
+        return true;
+    }
+    bool steal(Task & task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tasks.empty()) { return false; }
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        return true;
+    }
+private:
+    std::mutex m_mutex;
+    std::deque<Task> m_tasks;
+}; /* end class TaskDeque */
+
+class Walker
+{
+public:
+    Walker(unsigned nworker, bool defer, WalkOptions const & options)
+      : m_deques(nworker), m_results(nworker), m_defer(defer), m_cache(options.cache)
+    {
+        // Small files get one thread each from auto_thread_count(); large
+        // ones are split into chunks like a single file argument, within
+        // the share of the workers' threads count() gives them.  Decoding is
+        // not: every worker may already be decoding a file.
+        m_options.nthread = options.decompress ? 1 : 0;
+        m_options.decompress = options.decompress;
+        m_options.newline = options.newline;
+        m_options.page_cache = options.page_cache;
+        m_options.populate = options.populate;
+        m_options.hugepage = options.hugepage;
+    }
+
+    /// Queue a task on the deque of worker iworker.
+    void push(unsigned iworker, Task && task)
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_deques[iworker].push(std::move(task));
+        m_queued.fetch_add(1, std::memory_order_release);
+        wake(false);
+    }
+
+    void record(unsigned iworker, size_t root, std::string const & path, size_t lines, int error, bool deferred=false)
+    {
+        Entry entry;
+        entry.root = root;
+        entry.count.path = path;
+        entry.count.lines = lines;
+        entry.count.error = error;
+        entry.deferred = deferred;
+        m_results[iworker].push_back(std::move(entry));
+    }
+
+    void run(unsigned iworker)
+    {
+        unsigned const nworker = static_cast<unsigned>(m_deques.size());
+        Task task;
+        while (m_pending.load(std::memory_order_acquire) > 0)
+        {
+            bool found = m_deques[iworker].pop(task);
+            for (unsigned it=1; !found && it<nworker; ++it)
+            {
+                found = m_deques[(iworker + it) % nworker].steal(task);
+            }
+            if (!found)
+            {
+                // Sleep until a task is queued or the last one is done.
+                std::unique_lock<std::mutex> lock(m_idle_mutex);
+                m_idle.wait(lock, [this]()
+                {
+                    return m_queued.load(std::memory_order_acquire) > 0
+                        || m_pending.load(std::memory_order_acquire) == 0;
+                });
+                continue;
+            }
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            if (task.directory) { list(iworker, task); }
+            else { count(iworker, task); }
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) { wake(true); }
+        }
+    }
+
+    std::vector<Entry> collect()
+    {
+        std::vector<Entry> entries;
+        for (std::vector<Entry> & results : m_results)
+        {
+            std::move(results.begin(), results.end(), std::back_inserter(entries));
+        }
+        std::sort(entries.begin(), entries.end(), [](Entry const & a, Entry const & b)
+        {
+            return a.root != b.root ? a.root < b.root : a.count.path < b.count.path;
+        });
+        return entries;
+    }
+
+private:
+
+    /// Wake one idle worker, or all of them at the end of the walk.  The
+    /// mutex is taken so that a worker about to wait cannot miss the change.
+    void wake(bool all)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_idle_mutex);
+        }
+        if (all) { m_idle.notify_all(); }
+        else { m_idle.notify_one(); }
+    }
+
+    void count(unsigned iworker, Task const & task)
+    {
+        if (m_defer && task.regular)
+        {
+            record(iworker, task.root, task.path, 0, 0, true);
+            return;
+        }
+        // The workers counting a file at the same time share nworker
+        // threads, so that a large file found while the others are busy
+        // does not add a thread per CPU on top of them.
+        unsigned const nworker = static_cast<unsigned>(m_deques.size());
+        unsigned const nbusy = m_busy.fetch_add(1, std::memory_order_relaxed) + 1;
+        Options options = m_options;
+        options.max_thread = std::max(1U, nworker / nbusy);
+        try
+        {
+            size_t const lines = m_cache ? m_cache->count(task.path, nullptr, options.max_thread)
+                                         : count_file(task.path, options);
+            record(iworker, task.root, task.path, lines, 0);
+        }
+        catch (std::system_error const & e)
+        {
+            record(iworker, task.root, task.path, 0, e.code().value());
+        }
+        m_busy.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void list(unsigned iworker, Task const & task)
+    {
+        std::unique_ptr<DIR, int (*)(DIR *)> dir(::opendir(task.path.c_str()), ::closedir);
+        if (!dir)
+        {
+            record(iworker, task.root, task.path, 0, errno);
+            return;
+        }
+        std::string const prefix = task.path.back() == '/' ? task.path : task.path + "/";
+        while (struct dirent const * ent = ::readdir(dir.get()))
+        {
+            std::string const name(ent->d_name);
+            if (name == "." || name == "..") { continue; }
+            std::string path = prefix + name;
+            unsigned char type = ent->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                struct stat st;
+                int const ret = (type == DT_LNK) ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st);
+                if (ret != 0) { continue; }
+                if (S_ISREG(st.st_mode)) { type = DT_REG; }
+                else if (S_ISDIR(st.st_mode) && ent->d_type == DT_UNKNOWN) { type = DT_DIR; }
+                else { continue; }
+            }
+            if (type == DT_DIR)
+            {
+                push(iworker, Task{task.root, std::move(path), true, false});
+            }
+            else if (type == DT_REG)
+            {
+                push(iworker, Task{task.root, std::move(path), false, true});
+            }
+        }
+    }
+
+    std::vector<TaskDeque> m_deques;
+    std::vector<std::vector<Entry>> m_results;
+    bool m_defer;
+    LineCache * m_cache;
+    Options m_options;
+    /// Tasks not finished yet, counting the running ones.
+    std::atomic<size_t> m_pending{0};
+    /// Workers counting a file.
+    std::atomic<unsigned> m_busy{0};
+    /// Tasks in the deques; briefly negative when a task is taken before its
+    /// push is counted.
+    std::atomic<std::ptrdiff_t> m_queued{0};
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle;
+}; /* end class Walker */
+
+/// Count the deferred entries through io_uring, or one by one if the ring
+/// cannot be set up after all.
+void count_deferred(std::vector<Entry> & entries, Newline newline)
+{
+    std::vector<std::string> paths;
+    std::vector<size_t> indices;
+    for (size_t it=0; it<entries.size(); ++it)
+    {
+        if (entries[it].deferred)
+        {
+            paths.push_back(entries[it].count.path);
+            indices.push_back(it);
+        }
+    }
+    std::vector<FileCount> counts;
+    try
+    {
+        UringOptions uring_options;
+        uring_options.newline = newline;
+        counts = count_files_uring(paths, uring_options);
+    }
+    catch (std::system_error const & )
+    {
+        Options options;
+        options.nthread = 1;
+        options.newline = newline;
+        counts.resize(paths.size());
+        for (size_t it=0; it<paths.size(); ++it)
+        {
+            counts[it].path = paths[it];
+            try { counts[it].lines = count_file(paths[it], options); }
+            catch (std::system_error const & e) { counts[it].error = e.code().value(); }
+        }
+    }
+    for (size_t it=0; it<indices.size(); ++it)
+    {
+        entries[indices[it]].count = std::move(counts[it]);
+    }
+}
+
+} /* end namespace */
+
+std::vector<FileCount> count_paths(std::vector<std::string> const & paths, WalkOptions const & options)
+{
+    unsigned nworker = options.nthread ? options.nthread : std::thread::hardware_concurrency();
+    nworker = std::max(1U, nworker);
+    bool const defer = options.io == IoBackend::uring && !options.decompress && !options.cache
+                    && options.page_cache == PageCache::keep && uring_available();
+    Walker walker(nworker, defer, options);
+
+    for (size_t it=0; it<paths.size(); ++it)
+    {
+        struct stat st;
+        if (::stat(paths[it].c_str(), &st) != 0)
+        {
+            walker.record(0, it, paths[it], 0, errno);
+        }
+        else if (S_ISDIR(st.st_mode) && !options.recursive)
+        {
+            walker.record(0, it, paths[it], 0, EISDIR);
+        }
+        else
+        {
+            walker.push(static_cast<unsigned>(it % nworker), Task{it, paths[it], S_ISDIR(st.st_mode), S_ISREG(st.st_mode)});
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned it=1; it<nworker; ++it)
+    {
+        threads.emplace_back([&walker, it]() { walker.run(it); });
+    }
+    walker.run(0);
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+
+    std::vector<Entry> entries = walker.collect();
+    if (defer) { count_deferred(entries, options.newline); }
+    std::vector<FileCount> counts;
+    counts.reserve(entries.size());
+    for (Entry & entry : entries)
+    {
+        counts.push_back(std::move(entry.count));
+    }
+    return counts;
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
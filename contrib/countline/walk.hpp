@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+ * Counting many files and directory trees in one process.
+ */
+
+#include "countline.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace countline
+{
+
+class LineCache;
+
+enum class IoBackend
+{
+    /// Worker threads read files with mmap() or read().
+    pread,
+    /// The walk only collects files; one io_uring reads them all.
+    uring,
+}; /* end enum class IoBackend */
+
+struct WalkOptions
+{
+    /// Descend into directories instead of reporting them as errors.
+    bool recursive = false;
+    /// Number of worker threads; 0 uses the number of hardware threads.
+    unsigned nthread = 0;
+    /// How files are read; io_uring falls back to pread when unavailable.
+    IoBackend io = IoBackend::pread;
+    /// Count the decompressed content of compressed files (always read with
+    /// pread).
+    bool decompress = false;
+    /// What ends a line.
+    Newline newline = Newline::universal;
+    /// What to do with the page cache; anything but keep reads with pread.
+    PageCache page_cache = PageCache::keep;
+    /// Fault the whole mapping of a file in at once (MAP_POPULATE).
+    bool populate = false;
+    /// Ask for huge pages on the mapping of a file (MADV_HUGEPAGE).
+    bool hugepage = false;
+    /// Count files through this cache (read with pread), if set.
+    LineCache * cache = nullptr;
+}; /* end struct WalkOptions */
+
+/// Outcome of counting one file.
+struct FileCount
+{
+    std::string path;
+    size_t lines = 0;
+    /// errno of the failure, or 0 when lines is valid.
+    int error = 0;
+}; /* end struct FileCount */
+
+/**
+ * Count the lines of every file named by paths, descending into directories
+ * when requested.
+ *
+ * Directories are listed and files counted concurrently by a pool of workers
+ * that each own a task deque and steal from the others when theirs runs dry.
+ * Inside directories only regular files (directly or through a symbolic link)
+ * are counted, and symbolic links to directories are not followed.
+ *
+ * The result is ordered by the position of the originating argument and then
+ * by path, so it does not depend on scheduling.
+ */
+std::vector<FileCount> count_paths(std::vector<std::string> const & paths, WalkOptions const & options);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,431 @@
+#include "watch.hpp"
+#include "batch.hpp"
+#include "fileio.hpp"
+#include "unixsocket.hpp"
+
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace countline
+{
+
+namespace
+{
+
+/// Events of a watched directory that may change the count of a file in it.
+constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE
+                              | IN_MOVED_FROM | IN_MOVED_TO;
+
+struct Tracked
+{
+    explicit Tracked(Newline newline) : counter(newline) {}
+
+    /// Named on the command line: kept while it does not exist.
+    bool named = false;
+    LineCounter counter;
+    /// The file counted so far, to tell a rotated file from a grown one.
+    bool seen = false;
+    dev_t dev = 0;
+    ino_t ino = 0;
+    size_t rotations = 0;
+    /// errno of the last failed read, or 0.
+    int error = 0;
+}; /* end struct Tracked */
+
+struct DirPrefix
+{
+    /// Prepended to the names of the events: the directory resolved by
+    /// realpath() and a slash.
+    std::string prefix;
+    /// Track every regular file in the directory, not only the named ones.
+    bool all = false;
+}; /* end struct DirPrefix */
+
+/// The directories behind one inotify watch descriptor: the kernel returns
+/// the same one for every path that leads to the directory, and resolved
+/// paths still differ across bind mounts.
+using DirWatch = std::vector<DirPrefix>;
+
+/// Split path into the prefix of its directory and its last component.
+void split_path(std::string const & path, std::string & prefix, std::string & name)
+{
+    size_t const slash = path.find_last_of('/');
+    prefix = (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+    name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+/// The directory dir resolved by realpath(), with a trailing slash.
+std::string resolve_dir(std::string const & dir)
+{
+    std::unique_ptr<char, void (*)(void *)> const resolved(::realpath(dir.c_str(), nullptr), std::free);
+    if (!resolved) { throw_errno(dir); }
+    std::string prefix(resolved.get());
+    if (prefix.back() != '/') { prefix += '/'; }
+    return prefix;
+}
+
+class Watcher
+{
+public:
+    Watcher(std::vector<std::string> const & paths, WatchOptions const & options)
+      : m_options(options), m_buffer(STREAM_BUFFER_SIZE)
+    {
+        m_inotify.reset(new Descriptor(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC), "inotify_init1"));
+        for (std::string const & path : paths)
+        {
+            struct stat st;
+            if (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                add_watch(resolve_dir(path), true);
+                continue;
+            }
+            // Only the directory is resolved: a named symbolic link is
+            // followed anew at each read, as rotation schemes expect.
+            std::string prefix, name;
+            split_path(path, prefix, name);
+            prefix = resolve_dir(prefix.empty() ? "." : prefix);
+            add_watch(prefix, false);
+            m_files.emplace(prefix + name, Tracked(m_options.newline)).first->second.named = true;
+        }
+        if (!m_options.socket_path.empty()) { m_socket = listen_unix(m_options.socket_path); }
+    }
+
+    ~Watcher()
+    {
+        if (m_socket) { ::unlink(m_options.socket_path.c_str()); }
+    }
+
+    void run()
+    {
+        sigset_t stop, saved;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        ::pthread_sigmask(SIG_BLOCK, &stop, &saved);
+        try
+        {
+            Descriptor const signal(::signalfd(-1, &stop, SFD_CLOEXEC), "signalfd");
+            loop(signal.fd());
+        }
+        catch (...)
+        {
+            ::pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+            throw;
+        }
+        ::pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+    }
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    void add_watch(std::string const & prefix, bool all)
+    {
+        int const wd = ::inotify_add_watch(m_inotify->fd(), prefix.c_str(), WATCH_MASK | IN_ONLYDIR);
+        if (wd < 0) { throw_errno(prefix); }
+        DirWatch & watch = m_dirs[wd];
+        auto const found = std::find_if(watch.begin(), watch.end(), [&prefix](DirPrefix const & dir)
+        {
+            return dir.prefix == prefix;
+        });
+        if (found == watch.end()) { watch.push_back(DirPrefix{prefix, all}); }
+        else { found->all = found->all || all; }
+    }
+
+    /// Track the regular files present in the directories watched whole.
+    void scan()
+    {
+        for (auto const & item : m_dirs)
+        {
+            for (DirPrefix const & watch : item.second)
+            {
+                if (!watch.all) { continue; }
+                std::unique_ptr<DIR, int (*)(DIR *)> dir(::opendir(watch.prefix.c_str()), ::closedir);
+                if (!dir) { continue; }
+                while (struct dirent const * ent = ::readdir(dir.get()))
+                {
+                    if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN) { continue; }
+                    m_files.emplace(watch.prefix + ent->d_name, Tracked(m_options.newline));
+                }
+            }
+        }
+    }
+
+    void loop(int signal_fd)
+    {
+        scan();
+        for (auto & item : m_files) { m_dirty.insert(item.first); }
+        refresh(true);
+        write_status();
+
+        Clock::time_point last_status = Clock::now();
+        for (;;)
+        {
+            int timeout = -1;
+            if (m_changed && !m_options.status_path.empty())
+            {
+                auto const due = last_status + std::chrono::seconds(m_options.interval);
+                timeout = static_cast<int>(std::max<Clock::rep>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count()));
+            }
+            struct pollfd fds[3] = {
+                {m_inotify->fd(), POLLIN, 0},
+                {signal_fd, POLLIN, 0},
+                {m_socket ? m_socket->fd() : -1, POLLIN, 0},
+            };
+            if (::poll(fds, 3, timeout) < 0)
+            {
+                if (errno == EINTR) { continue; }
+                throw_errno("poll");
+            }
+            if (fds[1].revents)
+            {
+                // Consume the signal, or restoring the mask would deliver it.
+                struct signalfd_siginfo info;
+                ssize_t const nread = ::read(signal_fd, &info, sizeof(info));
+                static_cast<void>(nread);
+                break;
+            }
+            if (fds[0].revents)
+            {
+                read_events();
+                refresh();
+            }
+            if (fds[2].revents) { serve(); }
+            if (m_changed && !m_options.status_path.empty()
+                && Clock::now() >= last_status + std::chrono::seconds(m_options.interval))
+            {
+                write_status();
+                last_status = Clock::now();
+            }
+        }
+        if (m_changed) { write_status(); }
+    }
+
+    /// Mark the files named by the pending inotify events.
+    void read_events()
+    {
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        for (;;)
+        {
+            ssize_t const nread = ::read(m_inotify->fd(), buffer, sizeof(buffer));
+            if (nread < 0)
+            {
+                if (errno == EINTR) { continue; }
+                if (errno == EAGAIN) { return; }
+                throw_errno("inotify");
+            }
+            for (char const * it = buffer; it < buffer + nread; )
+            {
+                struct inotify_event const * event = reinterpret_cast<struct inotify_event const *>(it);
+                it += sizeof(struct inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // Events were lost: look at everything again.
+                    scan();
+                    for (auto & item : m_files) { m_dirty.insert(item.first); }
+                    continue;
+                }
+                auto const watch = m_dirs.find(event->wd);
+                if (watch == m_dirs.end() || !event->len || (event->mask & IN_ISDIR)) { continue; }
+                for (DirPrefix const & dir : watch->second)
+                {
+                    std::string const path = dir.prefix + event->name;
+                    if (!dir.all && !m_files.count(path)) { continue; }
+                    m_files.emplace(path, Tracked(m_options.newline));
+                    m_dirty.insert(path);
+                    if (event->mask & IN_DELETE) { m_deleted.insert(path); }
+                    else { m_deleted.erase(path); }
+                }
+            }
+        }
+    }
+
+    /// Read what the marked files gained since they were last read; with
+    /// report_all, print every count and not only those that changed.
+    void refresh(bool report_all = false)
+    {
+        for (std::string const & path : m_dirty)
+        {
+            auto found = m_files.find(path);
+            if (found == m_files.end()) { continue; }
+            Tracked & tracked = found->second;
+            size_t const lines = tracked.counter.lines();
+            size_t const rotations = tracked.rotations;
+            int const error = tracked.error;
+            update(path, tracked);
+            if (!tracked.named && tracked.error && (tracked.error != ENOENT || m_deleted.count(path)))
+            {
+                // A file of a watched directory that was deleted or is not
+                // a regular file.  One renamed away stays, so that its
+                // replacement counts as a rotation.
+                m_files.erase(found);
+                m_changed = true;
+                continue;
+            }
+            bool const changed = tracked.counter.lines() != lines || tracked.rotations != rotations
+                              || tracked.error != error;
+            m_changed = m_changed || changed;
+            if ((changed || report_all) && m_options.status_path.empty() && m_options.socket_path.empty())
+            {
+                print(path, tracked);
+            }
+        }
+        m_dirty.clear();
+        m_deleted.clear();
+    }
+
+    void update(std::string const & path, Tracked & tracked)
+    {
+        try
+        {
+            File const file(path, O_NONBLOCK);
+            struct stat st;
+            if (::fstat(file.fd(), &st) != 0) { throw_errno(path); }
+            if (!S_ISREG(st.st_mode))
+            {
+                throw std::system_error(S_ISDIR(st.st_mode) ? EISDIR : EINVAL, std::generic_category(), path);
+            }
+            size_t const size = static_cast<size_t>(st.st_size);
+            if (tracked.seen && (st.st_dev != tracked.dev || st.st_ino != tracked.ino || size < tracked.counter.bytes()))
+            {
+                tracked.counter = LineCounter(m_options.newline);
+                ++tracked.rotations;
+            }
+            tracked.seen = true;
+            tracked.dev = st.st_dev;
+            tracked.ino = st.st_ino;
+            tracked.error = 0;
+            // Stop at the size seen: what is appended meanwhile has its own event.
+            while (tracked.counter.bytes() < size)
+            {
+                size_t const offset = tracked.counter.bytes();
+                size_t const nread = pread_full(file.fd(), m_buffer.data(), std::min(m_buffer.size(), size - offset),
+                                                static_cast<off_t>(offset));
+                if (nread == 0) { break; }
+                tracked.counter.update(m_buffer.data(), nread);
+            }
+        }
+        catch (std::system_error const & e)
+        {
+            tracked.counter = LineCounter(m_options.newline);
+            tracked.error = e.code().value();
+        }
+    }
+
+    void print(std::string const & path, Tracked const & tracked) const
+    {
+        if (tracked.error == ENOENT)
+        {
+            std::printf("%s not found\n", path.c_str());
+        }
+        else if (tracked.error)
+        {
+            std::fprintf(stderr, "countline: %s: %s\n", path.c_str(), std::strerror(tracked.error));
+        }
+        else
+        {
+            std::printf("%zu lines in %s\n", tracked.counter.lines(), path.c_str());
+        }
+        std::fflush(stdout);
+    }
+
+    /// The current counts as JSON Lines.
+    std::string snapshot() const
+    {
+        std::string out;
+        char number[128];
+        for (auto const & item : m_files)
+        {
+            Tracked const & tracked = item.second;
+            out += '{';
+            append_json_field(out, "path", item.first);
+            if (tracked.error)
+            {
+                std::snprintf(number, sizeof(number), ", \"lines\": null, \"bytes\": null, \"rotations\": %zu",
+                              tracked.rotations);
+                out += number;
+                out += ", \"error\": \"";
+                append_json(out, std::strerror(tracked.error));
+                out += "\"}\n";
+            }
+            else
+            {
+                std::snprintf(number, sizeof(number), ", \"lines\": %zu, \"bytes\": %zu, \"rotations\": %zu",
+                              tracked.counter.lines(), tracked.counter.bytes(), tracked.rotations);
+                out += number;
+                out += ", \"error\": null}\n";
+            }
+        }
+        return out;
+    }
+
+    /// Replace the status file; a failure is reported and retried next time.
+    void write_status()
+    {
+        if (m_options.status_path.empty()) { return; }
+        std::string const text = snapshot();
+        std::string const temp = m_options.status_path + ".tmp";
+        FILE * out = std::fopen(temp.c_str(), "w");
+        bool ok = out && std::fwrite(text.data(), 1, text.size(), out) == text.size();
+        if (out) { ok = (std::fclose(out) == 0) && ok; }
+        if (ok && std::rename(temp.c_str(), m_options.status_path.c_str()) == 0)
+        {
+            m_changed = false;
+            return;
+        }
+        std::fprintf(stderr, "countline: %s: %s\n", m_options.status_path.c_str(), std::strerror(errno));
+        ::unlink(temp.c_str());
+    }
+
+    /// Send the counts to a client and hang up.
+    void serve()
+    {
+        int const fd = ::accept4(m_socket->fd(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) { return; }
+        Descriptor const client(fd, "accept");
+        // A client that does not read must not stall the watch.
+        set_io_timeout(client.fd(), 1);
+        send_all(client.fd(), snapshot());
+    }
+
+    WatchOptions m_options;
+    std::unique_ptr<Descriptor> m_inotify;
+    std::unique_ptr<Descriptor> m_socket;
+    std::map<int, DirWatch> m_dirs;
+    std::map<std::string, Tracked> m_files;
+    std::set<std::string> m_dirty;
+    std::set<std::string> m_deleted;
+    /// Whether the counts changed since the status file was written.
+    bool m_changed = true;
+    std::vector<char> m_buffer;
+}; /* end class Watcher */
+
+} /* end namespace */
+
+void run_watch(std::vector<std::string> const & paths, WatchOptions const & options)
+{
+    Watcher watcher(paths, options);
+    watcher.run();
+}
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
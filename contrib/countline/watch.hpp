@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * Watch mode: keep the line counts of growing files up to date with inotify.
+ */
+
+#include "countline.hpp"
+
+#include <string>
+#include <vector>
+
+namespace countline
+{
+
+struct WatchOptions
+{
+    /// What ends a line.
+    Newline newline = Newline::universal;
+    /// Rewrite this file with the current counts, if set.
+    std::string status_path;
+    /// Answer connections on this Unix socket with the current counts, if set.
+    std::string socket_path;
+    /// Seconds between rewrites of the status file.
+    unsigned interval = 1;
+}; /* end struct WatchOptions */
+
+/**
+ * Watch files and directories and keep the line count of every file current
+ * until SIGINT or SIGTERM.
+ *
+ * Only the parent directories of the files (and the directories themselves)
+ * are watched, so a file that is renamed away and created again, as log
+ * rotation does, is picked up under its name.  An event only marks a file;
+ * after each batch of events the marked files are read from where the last
+ * read stopped.  A file with a new inode, or one shorter than what was
+ * counted (copytruncate), is counted again from the start.  Directories are
+ * not descended into.  Files are reported under their directory resolved by
+ * realpath(), so that two spellings of one directory watch the same files.
+ *
+ * The counts are written as JSON Lines, one object per file with path,
+ * lines, bytes, rotations and error, to the status file (replaced atomically,
+ * at most every interval seconds and only when something changed) and to
+ * every client connecting to the socket.  With neither, every change is
+ * printed to standard output as "N lines in FILE".  Throws std::system_error
+ * when the watches or the socket cannot be set up.
+ */
+void run_watch(std::vector<std::string> const & paths, WatchOptions const & options);
+
+} /* end namespace countline */
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
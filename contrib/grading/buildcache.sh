@@ -0,0 +1,201 @@
+#!/bin/bash
+#
+# Cache compiler outputs by the content they are built from.
+#
+# usage: buildcache.sh COMPILER ARG...
+#        buildcache.sh --shims DIR
+#        buildcache.sh --stats | --clear
+#
+# A compiler call is looked up by the hash of the preprocessed sources (the
+# other input files by their bytes), the arguments besides the output name,
+# and the compiler's identity (its file and "-v" output).  On a hit the
+# output file and the compiler's warnings come from the cache and nothing is
+# compiled; on a miss the compiler runs and a successful output is stored.
+# Only the file compiled or linked is touched, so make still decides what to
+# rebuild from its own timestamps and "make clean" removes the same files:
+# the Makefile under test sees the same commands run either way.  The
+# dependency file of -MD or -MMD (named by -MF, else after the output) is
+# stored as a second output; it names the target and the headers as they were
+# given, so relative paths keep it valid in another build directory.  Other
+# calls producing more than the one output (-M or -MM alone, profiling data,
+# several objects at once, response files) are passed through.
+#
+# "--shims DIR" fills DIR with links named after the compilers found in PATH
+# (g++, c++, gcc, cc, clang++, clang); with DIR first in PATH, a Makefile
+# calling "g++" goes through the cache.  The cache lives in $BUILDCACHE_DIR
+# (default ~/.cache/grading-buildcache); BUILDCACHE_DISABLE=1 turns it off.
+# Relinking against a changed system library is not noticed; --clear after
+# changing the toolchain setup.
+
+self="$(realpath "${BASH_SOURCE[0]}")"
+cache_dir="${BUILDCACHE_DIR:-${XDG_CACHE_HOME:-$HOME/.cache}/grading-buildcache}"
+compilers="g++ c++ gcc cc clang++ clang"
+
+# Print the first NAME in PATH that is not a link to this script.
+find_compiler() {
+  local name=$1 dir
+  local IFS=:
+  for dir in $PATH ; do
+    if [ -z "$dir" ] || [ ! -x "$dir/$name" ] || [ -d "$dir/$name" ] ; then continue ; fi
+    if [ "$(realpath "$dir/$name")" == "$self" ] ; then continue ; fi
+    echo "$dir/$name"
+    return 0
+  done
+  return 1
+}
+
+case "$1" in
+  --shims)
+    if [ -z "$2" ] ; then echo "usage: $(basename $0) --shims DIR" >&2 ; exit 2 ; fi
+    mkdir -p "$2" || exit 2
+    for name in $compilers ; do
+      if find_compiler $name > /dev/null ; then ln -sf "$self" "$2/$name" ; fi
+    done
+    exit 0
+    ;;
+  --stats)
+    hits=0 ; misses=0
+    if [ -f "$cache_dir/log" ] ; then
+      hits=$(grep -c '^hit' "$cache_dir/log")
+      misses=$(grep -c '^miss' "$cache_dir/log")
+    fi
+    entries=$(find "$cache_dir" -name '*.out' 2>/dev/null | wc -l)
+    size=$(du -sh "$cache_dir" 2>/dev/null | cut -f1)
+    echo "cache: $cache_dir"
+    echo "entries: $entries (${size:-0})"
+    echo "hits: $hits misses: $misses"
+    exit 0
+    ;;
+  --clear)
+    rm -rf "$cache_dir"
+    exit 0
+    ;;
+esac
+
+# Called through a shim the compiler is our name, else the first argument.
+name="$(basename "$0")"
+if [ "$(realpath "$0")" == "$self" ] && [ "$name" == "$(basename "$self")" ] ; then
+  if [ $# -lt 1 ] ; then echo "usage: $(basename $0) COMPILER ARG..." >&2 ; exit 2 ; fi
+  name=$1
+  shift
+fi
+if [[ "$name" == */* ]] ; then
+  compiler="$name"
+else
+  compiler="$(find_compiler "$name")"
+  if [ -z "$compiler" ] ; then echo "$name: command not found" >&2 ; exit 127 ; fi
+fi
+
+if [ -n "$BUILDCACHE_DISABLE" ] ; then exec "$compiler" "$@" ; fi
+
+# Sort the arguments into inputs, the output, and the rest.
+args=("$@")
+sources=()
+others=()
+flags=()
+output=
+mode=link
+deps=
+dep_file=
+dep_flags=()
+while [ $# -gt 0 ] ; do
+  arg=$1
+  shift
+  case "$arg" in
+    -o) output=$1 ; shift ;;
+    -o*) output=${arg#-o} ;;
+    -c) mode=compile ; flags+=("$arg") ;;
+    -S) mode=assemble ; flags+=("$arg") ;;
+    -MD|-MMD) deps=$arg ; dep_flags+=("$arg") ;;
+    -MF) dep_file=$1 ; shift ;;
+    -MF*) dep_file=${arg#-MF} ;;
+    -MT|-MQ) dep_flags+=("$arg" "$1") ; shift ;;
+    -MT*|-MQ*|-MP|-MG) dep_flags+=("$arg") ;;
+    -E|-M*|-x|-x*|-save-temps*|-fprofile*|-ftest-coverage|--coverage|-|@*)
+      exec "$compiler" "${args[@]}" ;;
+    -I|-D|-U|-L|-l|-include|-imacros|-isystem|-iquote|-idirafter|-isysroot|-Xlinker)
+      flags+=("$arg" "$1") ; shift ;;
+    -*) flags+=("$arg") ;;
+    *.c|*.cc|*.cpp|*.cxx|*.c++|*.C|*.i|*.ii) sources+=("$arg") ;;
+    *) others+=("$arg") ;;
+  esac
+done
+if [ -z "$output" ] ; then
+  if [ $mode == link ] ; then
+    output=a.out
+  elif [ ${#sources[@]} -eq 1 ] && [ ${#others[@]} -eq 0 ] ; then
+    output="$(basename "${sources[0]%.*}")"
+    if [ $mode == compile ] ; then output="$output.o" ; else output="$output.s" ; fi
+  fi
+fi
+if [ -z "$output" ] || [ $(( ${#sources[@]} + ${#others[@]} )) -eq 0 ] ; then exec "$compiler" "${args[@]}" ; fi
+if [ -n "$deps" ] ; then
+  if [ $mode == link ] || [ ${#sources[@]} -ne 1 ] ; then exec "$compiler" "${args[@]}" ; fi
+  if [ -z "$dep_file" ] ; then
+    # As the compiler names it: the output with its suffix replaced.
+    if [[ "${output##*/}" == *.* ]] ; then dep_file="${output%.*}.d" ; else dep_file="$output.d" ; fi
+  fi
+elif [ ${#dep_flags[@]} -ne 0 ] || [ -n "$dep_file" ] ; then
+  exec "$compiler" "${args[@]}"
+fi
+
+# The key: what the compiler is, what it is told, and what it reads.
+key=$(
+  set -o pipefail
+  {
+    echo "buildcache 2"
+    stat -L -c '%n %s %Y' "$compiler" && "$compiler" -v 2>&1
+    printf '%s\n' "${flags[@]}"
+    markers=-P
+    if [ -n "$deps" ] ; then
+      # The dependency file names the output (unless -MT or -MQ does) and
+      # the headers, which the line markers list as they were given.
+      echo "deps $output"
+      printf '%s\n' "${dep_flags[@]}"
+      markers=
+    fi
+    for source in "${sources[@]}" ; do
+      echo "source"
+      # Without line markers the temporary directory a source was built in
+      # does not matter.
+      "$compiler" "${flags[@]}" -E $markers "$source" 2> /dev/null || exit 1
+    done
+    for input in "${others[@]}" ; do
+      echo "input"
+      sha256sum < "$input" || exit 1
+    done
+  } | sha256sum
+) || exec "$compiler" "${args[@]}"
+key=${key%% *}
+entry="$cache_dir/${key:0:2}/$key"
+
+if [ -f "$entry.out" ] && { [ -z "$deps" ] || [ -f "$entry.d" ] ; } ; then
+  rm -f "$output"
+  if { [ -z "$deps" ] || { rm -f "$dep_file" && cp "$entry.d" "$dep_file" ; } ; } 2> /dev/null \
+    && cp "$entry.out" "$output" 2> /dev/null ; then
+    cat "$entry.err" >&2 2> /dev/null
+    # Dated now, as a fresh compile would be, whatever cp did.
+    touch "$output"
+    echo "hit $key $output" >> "$cache_dir/log"
+    exit 0
+  fi
+fi
+
+err=$(mktemp -t buildcache-XXXXXXXXXX)
+"$compiler" "${args[@]}" 2> "$err"
+ret=$?
+cat "$err" >&2
+if [ $ret -eq 0 ] && [ -f "$output" ] && { [ -z "$deps" ] || [ -f "$dep_file" ] ; } \
+  && mkdir -p "$cache_dir/${key:0:2}" ; then
+  # Stored under temporary names and renamed, the output last, so that a
+  # concurrent build never sees a partial entry.
+  cp "$err" "$entry.err.$$" && mv -f "$entry.err.$$" "$entry.err" \
+    && { [ -z "$deps" ] || { cp "$dep_file" "$entry.d.$$" && mv -f "$entry.d.$$" "$entry.d" ; } ; } \
+    && cp "$output" "$entry.out.$$" && mv -f "$entry.out.$$" "$entry.out"
+  rm -f "$entry.err.$$" "$entry.d.$$" "$entry.out.$$"
+  echo "miss $key $output" >> "$cache_dir/log"
+fi
+rm -f "$err"
+exit $ret
+
+# vim: set fenc=utf8 ff=unix et sw=2 ts=2 sts=2:
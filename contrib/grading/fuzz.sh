@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# Run the randomized checks of hw2 on a submission.
+#
+# usage: fuzz.sh [-t SECONDS] [-f] [-s] SUBMISSION
+#
+# q1: the C++ sources of SUBMISSION/q1 are compiled into fuzzline (with
+# their main renamed), built with AddressSanitizer and UndefinedBehaviorSanitizer
+# unless -f asks for speed, and run for SECONDS (default 10).
+# q2: SUBMISSION/q2 is copied to a temporary directory and built with make,
+# and fuzzvector.py checks the angle function of the module for SECONDS.
+# For grading it accepts errors of 1e-12 rad besides 4 ULPs: atan2 of
+# products rounded to doubles stays far below that, acos(dot / norms) does
+# not.  -s checks ULPs only.
+# Extra options for them come from $FUZZLINE_ARGS and $FUZZVECTOR_ARGS.
+# The exit status is 1 when either found a failing input.
+
+fuzz_path="$(realpath $(dirname ${BASH_SOURCE[0]}))"
+seconds=10
+sanitize="-O1 -fsanitize=address,undefined -fno-sanitize-recover=undefined -fno-omit-frame-pointer"
+vector_tolerance="--abs 1e-12"
+
+usage() {
+  echo "usage: $(basename $0) [-t SECONDS] [-f] [-s] SUBMISSION" >&2
+  exit 2
+}
+
+while getopts "t:fsh" opt ; do
+  case $opt in
+    t) seconds=$OPTARG ;;
+    f) sanitize="-O2" ;;
+    s) vector_tolerance= ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -ne 1 ] || [ ! -d "$1" ] ; then usage ; fi
+submission="$(realpath "$1")"
+
+tmp_dir=$(mktemp -d -t fuzz-XXXXXXXXXX)
+trap 'rm -rf "$tmp_dir"' EXIT
+status=0
+
+echo "q1: Line"
+sources=$(find "$submission/q1" -maxdepth 1 -name '*.cpp' 2>/dev/null | sort)
+if [ -z "$sources" ] ; then
+  echo "no C++ source in $submission/q1"
+  status=1
+else
+  # One translation unit, so that a class defined in a .cpp is visible.
+  for source in $sources ; do echo "#include \"$source\"" ; done > "$tmp_dir/sources.hpp"
+  ${CXX:-g++} -std=c++17 -g $sanitize -I"$submission/q1" \
+    -DFUZZLINE_SOURCES="\"$tmp_dir/sources.hpp\"" \
+    -o "$tmp_dir/fuzzline" "$fuzz_path/fuzzline.cpp" ; ret=$?
+  if [ $ret -ne 0 ] ; then
+    echo "cannot build fuzzline with the submission"
+    status=1
+  else
+    (cd "$tmp_dir" && ./fuzzline -t "$seconds" -o "$tmp_dir/q1-crash" $FUZZLINE_ARGS) ; ret=$?
+    if [ $ret -ne 0 ] ; then
+      if [ -f "$tmp_dir/q1-crash" ] ; then cp "$tmp_dir/q1-crash" ./fuzzline-crash ; echo "input kept in fuzzline-crash" ; fi
+      status=1
+    fi
+  fi
+fi
+
+echo "q2: _vector"
+if [ ! -d "$submission/q2" ] ; then
+  echo "no $submission/q2"
+  status=1
+else
+  cp -a "$submission/q2" "$tmp_dir/q2"
+  if ! make -C "$tmp_dir/q2" > "$tmp_dir/q2-make.log" 2>&1 ; then
+    cat "$tmp_dir/q2-make.log"
+    echo "make failed"
+    status=1
+  else
+    python3 "$fuzz_path/fuzzvector.py" -t "$seconds" $vector_tolerance $FUZZVECTOR_ARGS "$tmp_dir/q2" ; ret=$?
+    if [ $ret -ne 0 ] ; then status=1 ; fi
+  fi
+fi
+
+exit $status
+
+# vim: set fenc=utf8 ff=unix et sw=2 ts=2 sts=2:
@@ -0,0 +1,408 @@
+/*
+ * fuzzline: drive the Line class of a hw2 submission with random operations.
+ *
+ * usage: fuzzline [-n RUNS] [-t SECONDS] [-s SEED] [-o CRASH] [INPUT...]
+ *
+ * The submission is compiled into this program (fuzz.sh does that: the
+ * sources are included through FUZZLINE_SOURCES with their main renamed).
+ * An input is a string of bytes read as a program of operations on a few
+ * Line objects: construct (empty, sized, copied, moved), copy and move
+ * assignment, self-assignment, writes of x and y, and destruction.  After
+ * every operation the objects are checked against a model made of
+ * std::vector<float>: the size and the bits of every coordinate have to
+ * match, so a shallow copy, a lost write or a stale size is caught at the
+ * operation that caused it.  A moved-from object is only assigned to or
+ * destroyed.
+ *
+ * Without INPUT, random inputs run until RUNS (default unlimited) or SECONDS
+ * (default 10) are used up, and the rate is printed.  A failing input is
+ * written to CRASH (default fuzzline-crash) and can be replayed by naming
+ * it.  Built with FUZZLINE_LIBFUZZER and -fsanitize=fuzzer (clang), the
+ * program is a libFuzzer target instead, taking its inputs from the fuzzer.
+ * Either way, building it with AddressSanitizer catches the memory errors
+ * the model cannot see.
+ *
+ * The exit status is 0 when every input passed, 1 when one failed and 2 on
+ * trouble.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef FUZZLINE_SOURCES
+#define main fuzzline_submission_main
+#include FUZZLINE_SOURCES
+#undef main
+#endif
+
+#ifndef FUZZLINE_LIBFUZZER
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#endif
+
+namespace
+{
+
+/// How many Line objects a program works on.
+constexpr size_t NSLOT = 4;
+/// The largest size a program constructs.
+constexpr size_t MAX_SIZE = 64;
+
+/// What a Line should hold.
+struct Model
+{
+    enum class State { empty, valid, moved };
+    State state = State::empty;
+    std::vector<float> x;
+    std::vector<float> y;
+}; /* end struct Model */
+
+/// The bytes of an input, read front to back; reads past the end give zero.
+class Reader
+{
+public:
+    Reader(uint8_t const * data, size_t size) : m_data(data), m_size(size) {}
+
+    bool done() const { return m_pos >= m_size; }
+
+    uint8_t byte() { return m_pos < m_size ? m_data[m_pos++] : 0; }
+
+    float number()
+    {
+        uint32_t bits = 0;
+        for (int it = 0; it < 4; ++it) { bits = (bits << 8) | byte(); }
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+private:
+    uint8_t const * m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+}; /* end class Reader */
+
+bool same_bits(float a, float b)
+{
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+class Program
+{
+public:
+    /// Run one input; return an empty string or what went wrong.
+    std::string run(uint8_t const * data, size_t size)
+    {
+        Reader in(data, size);
+        try
+        {
+            while (!in.done())
+            {
+                std::string error = step(in);
+                if (!error.empty()) { return error; }
+            }
+        }
+        catch (std::exception const & e)
+        {
+            return "operation " + std::to_string(m_nstep) + " threw: " + e.what();
+        }
+        return std::string();
+    }
+
+    /// The operations run so far.
+    size_t steps() const { return m_nstep; }
+
+private:
+
+    std::string step(Reader & in)
+    {
+        ++m_nstep;
+        uint8_t const op = in.byte();
+        size_t const i = in.byte() % NSLOT;
+        size_t const j = in.byte() % NSLOT;
+        std::optional<Line> & line = m_lines[i];
+        Model & model = m_models[i];
+        Model & other = m_models[j];
+        char what[128];
+        switch (op % 9)
+        {
+        case 0:
+            std::snprintf(what, sizeof(what), "Line() into %zu", i);
+            line.emplace();
+            model = Model{Model::State::valid, {}, {}};
+            break;
+        case 1:
+        {
+            size_t const n = in.byte() % (MAX_SIZE + 1);
+            std::snprintf(what, sizeof(what), "Line(%zu) into %zu", n, i);
+            line.emplace(n);
+            model = Model{Model::State::valid, std::vector<float>(n), std::vector<float>(n)};
+            // The contents of a new Line are not specified: take them.
+            for (size_t it = 0; it < n; ++it)
+            {
+                model.x[it] = static_cast<Line const &>(*line).x(it);
+                model.y[it] = static_cast<Line const &>(*line).y(it);
+            }
+            break;
+        }
+        case 2:
+            if (other.state != Model::State::valid || i == j) { return std::string(); }
+            std::snprintf(what, sizeof(what), "Line(Line const &) from %zu into %zu", j, i);
+            line.emplace(static_cast<Line const &>(*m_lines[j]));
+            model = other;
+            break;
+        case 3:
+            if (other.state != Model::State::valid || i == j) { return std::string(); }
+            std::snprintf(what, sizeof(what), "Line(Line &&) from %zu into %zu", j, i);
+            line.emplace(std::move(*m_lines[j]));
+            model = other;
+            other.state = Model::State::moved;
+            break;
+        case 4:
+            if (model.state == Model::State::empty || other.state != Model::State::valid) { return std::string(); }
+            std::snprintf(what, sizeof(what), "operator=(Line const &) from %zu into %zu", j, i);
+            *line = static_cast<Line const &>(*m_lines[j]);
+            model = Model(other);
+            break;
+        case 5:
+            if (model.state == Model::State::empty || other.state != Model::State::valid || i == j)
+            {
+                return std::string();
+            }
+            std::snprintf(what, sizeof(what), "operator=(Line &&) from %zu into %zu", j, i);
+            *line = std::move(*m_lines[j]);
+            model = other;
+            other.state = Model::State::moved;
+            break;
+        case 6:
+        case 7:
+        {
+            if (model.state != Model::State::valid || model.x.empty()) { return std::string(); }
+            size_t const it = in.byte() % model.x.size();
+            float const value = in.number();
+            bool const is_x = op % 9 == 6;
+            std::snprintf(what, sizeof(what), "%s(%zu) = %a in %zu", is_x ? "x" : "y", it, value, i);
+            (is_x ? line->x(it) : line->y(it)) = value;
+            (is_x ? model.x : model.y)[it] = value;
+            break;
+        }
+        default:
+            std::snprintf(what, sizeof(what), "~Line() of %zu", i);
+            line.reset();
+            model = Model();
+            break;
+        }
+        // An operation may only change its own objects; check all of them.
+        for (size_t it = 0; it < NSLOT; ++it)
+        {
+            std::string const error = check(it);
+            if (!error.empty())
+            {
+                return "operation " + std::to_string(m_nstep) + ", " + what + ": " + error;
+            }
+        }
+        return std::string();
+    }
+
+    std::string check(size_t slot) const
+    {
+        Model const & model = m_models[slot];
+        if (model.state != Model::State::valid) { return std::string(); }
+        Line const & line = *m_lines[slot];
+        char text[160];
+        if (line.size() != model.x.size())
+        {
+            std::snprintf(text, sizeof(text), "Line %zu has size %zu, expected %zu",
+                          slot, static_cast<size_t>(line.size()), model.x.size());
+            return text;
+        }
+        for (size_t it = 0; it < model.x.size(); ++it)
+        {
+            if (!same_bits(line.x(it), model.x[it]) || !same_bits(line.y(it), model.y[it]))
+            {
+                std::snprintf(text, sizeof(text), "Line %zu point %zu is (%a, %a), expected (%a, %a)",
+                              slot, it, line.x(it), line.y(it), model.x[it], model.y[it]);
+                return text;
+            }
+        }
+        return std::string();
+    }
+
+    std::optional<Line> m_lines[NSLOT];
+    Model m_models[NSLOT];
+    size_t m_nstep = 0;
+}; /* end class Program */
+
+} /* end namespace */
+
+#ifdef FUZZLINE_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const * data, size_t size)
+{
+    std::string const error = Program().run(data, size);
+    if (!error.empty())
+    {
+        std::fprintf(stderr, "fuzzline: %s\n", error.c_str());
+        std::abort();
+    }
+    return 0;
+}
+
+#else
+
+// Set by the sanitizers, which call it before they end the program.
+extern "C" void __sanitizer_set_death_callback(void (*callback)()) __attribute__((weak));
+
+namespace
+{
+
+/*
+ * The input being run, saved to the crash file when the program dies in the
+ * middle of it: a sanitizer report or a segmentation fault ends the process
+ * before the model sees anything.
+ */
+uint8_t const * g_input = nullptr;
+size_t g_input_size = 0;
+char const * g_crash_path = nullptr;
+
+void save_input()
+{
+    if (!g_input || !g_crash_path) { return; }
+    // Only async-signal-safe calls: this may run in a signal handler.
+    int const fd = ::open(g_crash_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { return; }
+    ssize_t const nwrite = ::write(fd, g_input, g_input_size);
+    static_cast<void>(nwrite);
+    ::close(fd);
+    char const message[] = "fuzzline: the failing input is in the crash file\n";
+    ssize_t const nmessage = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+    static_cast<void>(nmessage);
+}
+
+void save_input_on_signal(int signum)
+{
+    save_input();
+    ::raise(signum); // the handler was reset: die of the signal
+}
+
+void save_input_on_death()
+{
+    if (__sanitizer_set_death_callback)
+    {
+        __sanitizer_set_death_callback(save_input);
+        return;
+    }
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = save_input_on_signal;
+    action.sa_flags = SA_RESETHAND;
+    for (int signum : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+    {
+        ::sigaction(signum, &action, nullptr);
+    }
+}
+
+int usage()
+{
+    std::fputs("usage: fuzzline [-n RUNS] [-t SECONDS] [-s SEED] [-o CRASH] [INPUT...]\n", stderr);
+    return 2;
+}
+
+} /* end namespace */
+
+int main(int argc, char ** argv)
+{
+    unsigned long long runs = 0;
+    double seconds = 10;
+    unsigned long long seed = std::random_device()();
+    char const * crash = "fuzzline-crash";
+    int opt;
+    while ((opt = ::getopt(argc, argv, "n:t:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': runs = std::strtoull(optarg, nullptr, 10); break;
+        case 't': seconds = std::strtod(optarg, nullptr); break;
+        case 's': seed = std::strtoull(optarg, nullptr, 10); break;
+        case 'o': crash = optarg; break;
+        default: return usage();
+        }
+    }
+
+    if (optind < argc)
+    {
+        int status = 0;
+        for (int it = optind; it < argc; ++it)
+        {
+            std::ifstream file(argv[it], std::ios::binary);
+            if (!file)
+            {
+                std::fprintf(stderr, "fuzzline: cannot read %s\n", argv[it]);
+                return 2;
+            }
+            std::vector<uint8_t> const input{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+            std::string const error = Program().run(input.data(), input.size());
+            std::printf("%s: %s\n", argv[it], error.empty() ? "ok" : error.c_str());
+            if (!error.empty()) { status = 1; }
+        }
+        std::fflush(stdout);
+        return status;
+    }
+
+    g_crash_path = crash;
+    save_input_on_death();
+    std::mt19937_64 rng(seed);
+    std::vector<uint8_t> input;
+    auto const start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    unsigned long long nrun = 0;
+    unsigned long long nstep = 0;
+    for (; runs == 0 || nrun < runs; ++nrun)
+    {
+        // Check the clock only now and then: a run takes microseconds.
+        if (nrun % 1024 == 0)
+        {
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (runs == 0 && elapsed >= seconds) { break; }
+        }
+        input.resize(rng() % 512);
+        for (uint8_t & byte : input) { byte = static_cast<uint8_t>(rng()); }
+        g_input = input.data();
+        g_input_size = input.size();
+        Program program;
+        std::string const error = program.run(input.data(), input.size());
+        nstep += program.steps();
+        if (!error.empty())
+        {
+            std::printf("fuzzline: run %llu (seed %llu) failed at %s\n", nrun, seed, error.c_str());
+            std::ofstream(crash, std::ios::binary).write(reinterpret_cast<char const *>(input.data()), input.size());
+            std::printf("fuzzline: input written to %s\n", crash);
+            // LeakSanitizer ends the program without flushing.
+            std::fflush(stdout);
+            return 1;
+        }
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("fuzzline: %llu runs of %llu operations passed in %.1f s, %.0f operations/s (seed %llu)\n",
+                nrun, nstep, elapsed, elapsed > 0 ? nstep / elapsed : 0.0, seed);
+    std::fflush(stdout);
+    return 0;
+}
+
+#endif
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
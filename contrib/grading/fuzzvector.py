@@ -0,0 +1,269 @@
+#!/usr/bin/env python3
+
+# Check the angle function of a hw2 _vector module on random inputs.
+#
+# The module is imported from DIR (a built q2 directory).  Its angle function
+# is found by calling every public function of the module on two
+# perpendicular vectors, passed as two tuples, two lists or four numbers,
+# unless --function names it.  It is then called on a stream of random
+# vector pairs: random directions and magnitudes from 1e-30 to 1e30, and the
+# hard cases of acos-based formulas (parallel, anti-parallel, perpendicular
+# and nearly parallel vectors, negative zero).  Every result is compared with
+# a reference, atan2(|a x b|, a . b), computed with exact rational
+# arithmetic for the dot and cross products, and accepted within --ulp units
+# in the last place.  --abs also accepts an error up to that many radians; it
+# is off by default, since near zero an angle has ULPs far smaller than any
+# fixed bound and even 1e-7 rad lets acos(dot / norms) through.  Zero-length
+# vectors have no angle: a raised exception or a NaN is accepted there, and
+# which one is reported.
+#
+# With --hypothesis, and Hypothesis installed, a Hypothesis search follows the
+# random one; it shrinks a failing input to a small one.  The summary gives
+# the calls per second, the worst error in ULPs and its input; the exit
+# status is 1 when an input failed.
+
+import argparse
+import fractions
+import importlib
+import math
+import os
+import random
+import struct
+import sys
+import time
+
+
+def ulp_distance(a, b):
+    """The number of doubles between a and b."""
+    if math.isnan(a) or math.isnan(b):
+        return math.inf
+    ia = struct.unpack('<q', struct.pack('<d', a))[0]
+    ib = struct.unpack('<q', struct.pack('<d', b))[0]
+    # Order negative doubles below positive ones.
+    if ia < 0:
+        ia = -(ia & 0x7fffffffffffffff)
+    if ib < 0:
+        ib = -(ib & 0x7fffffffffffffff)
+    return abs(ia - ib)
+
+
+def reference_angle(a, b):
+    """The angle between a and b, correctly rounded up to atan2."""
+    ax, ay = (fractions.Fraction(v) for v in a)
+    bx, by = (fractions.Fraction(v) for v in b)
+    if (ax == 0 and ay == 0) or (bx == 0 and by == 0):
+        return None
+    dot = ax * bx + ay * by
+    cross = abs(ax * by - ay * bx)
+    # Scale both exactly before rounding, so that neither overflows nor
+    # underflows to zero.
+    scale = max(abs(dot), cross)
+    return math.atan2(float(cross / scale), float(dot / scale))
+
+
+CALL_STYLES = {
+    'tuples': lambda f, a, b: f(tuple(a), tuple(b)),
+    'lists': lambda f, a, b: f(list(a), list(b)),
+    'numbers': lambda f, a, b: f(a[0], a[1], b[0], b[1]),
+}
+
+
+def find_function(module, name=None):
+    """Return (name, style) of the angle function."""
+    names = [name] if name else sorted(n for n in dir(module) if not n.startswith('_'))
+    for candidate in names:
+        function = getattr(module, candidate, None)
+        if not callable(function):
+            continue
+        for style, call in CALL_STYLES.items():
+            try:
+                value = call(function, (1.0, 0.0), (0.0, 2.0))
+            except Exception:
+                continue
+            if isinstance(value, float) and abs(value - math.pi / 2) < 1e-6:
+                return candidate, style
+    return None, None
+
+
+def random_vector(rng):
+    angle = rng.uniform(-math.pi, math.pi)
+    length = 10.0 ** rng.uniform(-30, 30)
+    return (length * math.cos(angle), length * math.sin(angle))
+
+
+def random_pair(rng):
+    """A random pair, with the hard cases mixed in."""
+    a = random_vector(rng)
+    kind = rng.randrange(8)
+    if kind == 0:
+        return a, (a[0] * rng.uniform(0.1, 10), a[1] * rng.uniform(0.1, 10))
+    if kind == 1:
+        factor = rng.uniform(0.1, 10)
+        return a, (a[0] * factor, a[1] * factor)
+    if kind == 2:
+        factor = -rng.uniform(0.1, 10)
+        return a, (a[0] * factor, a[1] * factor)
+    if kind == 3:
+        return a, (-a[1], a[0])
+    if kind == 4:
+        # Nearly parallel: acos(dot / norms) loses half the digits here.
+        tilt = 10.0 ** rng.uniform(-12, -4)
+        return a, (a[0] - tilt * a[1], a[1] + tilt * a[0])
+    if kind == 5:
+        return (rng.choice([0.0, -0.0]), rng.uniform(-1, 1)), (rng.uniform(-1, 1), rng.choice([0.0, -0.0]))
+    if kind == 6 and rng.randrange(64) == 0:
+        zero = (rng.choice([0.0, -0.0]), rng.choice([0.0, -0.0]))
+        return (zero, a) if rng.randrange(2) else (a, zero)
+    return a, random_vector(rng)
+
+
+class Checker:
+
+    def __init__(self, call, ulp, absolute):
+        self.call = call
+        self.ulp = ulp
+        self.absolute = absolute
+        self.ncall = 0
+        self.failures = []
+        # How far past the tolerance the worst result was (1 is at it).
+        self.worst = (0.0, None)
+        self.invalid = set()
+        self.nzero = 0
+
+    def outcome(self, a, b):
+        """Call the function; return its value or the exception it raised."""
+        self.ncall += 1
+        try:
+            return self.call(a, b)
+        except Exception as e:
+            return e
+
+    def check(self, a, b, value):
+        """Check the outcome of one pair; return an error message or None."""
+        expected = reference_angle(a, b)
+        if expected is None:
+            self.nzero += 1
+        if isinstance(value, Exception):
+            e = value
+            if expected is None:
+                self.invalid.add('raises {}'.format(type(e).__name__))
+                return None
+            return 'angle({}, {}) raised {}: {}'.format(a, b, type(e).__name__, e)
+        if expected is None:
+            if isinstance(value, float) and math.isnan(value):
+                self.invalid.add('returns nan')
+                return None
+            return 'angle({}, {}) of a zero-length vector returned {!r}'.format(a, b, value)
+        if not isinstance(value, float):
+            return 'angle({}, {}) returned {!r}, not a float'.format(a, b, value)
+        distance = ulp_distance(value, expected)
+        error = abs(value - expected)
+        excess = min(distance / self.ulp if self.ulp else math.inf,
+                     error / self.absolute if self.absolute else math.inf)
+        if distance == 0 or math.isnan(excess):
+            excess = 0.0
+        if excess > self.worst[0]:
+            self.worst = (excess, (a, b, value, expected, distance, error))
+        if excess > 1:
+            return 'angle({!r}, {!r}) = {!r}, expected {!r} ({} ulp)'.format(a, b, value, expected, distance)
+        return None
+
+
+def run_random(checker, rng, count, seconds, max_failures):
+    """Check random pairs; return the seconds spent in the calls."""
+    start = time.perf_counter()
+    # Making the inputs and the exact references takes longer than the
+    # calls: the calls of a batch are timed apart from the rest.
+    elapsed = 0.0
+    while checker.ncall < count and len(checker.failures) < max_failures:
+        batch = [random_pair(rng) for _ in range(min(4096, count - checker.ncall))]
+        batch_start = time.perf_counter()
+        outcomes = [checker.outcome(a, b) for a, b in batch]
+        elapsed += time.perf_counter() - batch_start
+        for (a, b), value in zip(batch, outcomes):
+            error = checker.check(a, b, value)
+            if error:
+                checker.failures.append(error)
+                if len(checker.failures) >= max_failures:
+                    break
+        if time.perf_counter() - start >= seconds:
+            break
+    return elapsed
+
+
+def run_hypothesis(checker, examples):
+    try:
+        import hypothesis
+        from hypothesis import strategies
+    except ImportError:
+        sys.stderr.write('hypothesis is not installed; skipping the hypothesis search\n')
+        return
+    coordinate = strategies.floats(min_value=-1e30, max_value=1e30, allow_nan=False, allow_infinity=False)
+    vector = strategies.tuples(coordinate, coordinate)
+
+    @hypothesis.settings(max_examples=examples, deadline=None, database=None)
+    @hypothesis.given(vector, vector)
+    def angle_matches(a, b):
+        error = checker.check(a, b, checker.outcome(a, b))
+        assert error is None, error
+
+    try:
+        angle_matches()
+    except AssertionError as e:
+        checker.failures.append('hypothesis: {}'.format(e))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check the angle function of _vector on random inputs.')
+    parser.add_argument('directory', help='the directory holding the built _vector module')
+    parser.add_argument('--module', default='_vector', help='the module name (default _vector)')
+    parser.add_argument('--function', help='the angle function (default: found by calling)')
+    parser.add_argument('--count', '-n', type=int, default=1000000, help='random inputs (default 1000000)')
+    parser.add_argument('--seconds', '-t', type=float, default=10.0, help='time limit of the random inputs (default 10)')
+    parser.add_argument('--ulp', type=int, default=4, help='accepted error in ULPs (default 4)')
+    parser.add_argument('--abs', type=float, default=0.0, dest='absolute',
+                        help='also accept this absolute error in radians (default 0: ULPs only)')
+    parser.add_argument('--seed', type=int, default=None)
+    parser.add_argument('--hypothesis', type=int, default=0, metavar='EXAMPLES',
+                        help='also run a Hypothesis search of this many examples')
+    parser.add_argument('--max-failures', type=int, default=10)
+    args = parser.parse_args()
+
+    sys.path.insert(0, os.path.abspath(args.directory))
+    try:
+        module = importlib.import_module(args.module)
+    except ImportError as e:
+        sys.stderr.write('cannot import {}: {}\n'.format(args.module, e))
+        return 2
+    name, style = find_function(module, args.function)
+    if not name:
+        sys.stderr.write('no function of {} gives the angle of (1, 0) and (0, 2)\n'.format(args.module))
+        return 2
+    function = getattr(module, name)
+    call = CALL_STYLES[style]
+    checker = Checker(lambda a, b: call(function, a, b), args.ulp, args.absolute)
+
+    seed = args.seed if args.seed is not None else random.randrange(1 << 32)
+    elapsed = run_random(checker, random.Random(seed), args.count, args.seconds, args.max_failures)
+    ncall = checker.ncall
+    print('{}.{} ({}): {} random inputs, {:.0f} calls/s (seed {})'.format(
+        args.module, name, style, ncall, ncall / elapsed if elapsed else 0.0, seed))
+    if args.hypothesis and len(checker.failures) < args.max_failures:
+        run_hypothesis(checker, args.hypothesis)
+        print('hypothesis: {} examples'.format(checker.ncall - ncall))
+
+    excess, worst = checker.worst
+    if worst:
+        print('worst error: {:.3g} of the tolerance, angle({!r}, {!r}) = {!r}, expected {!r} ({} ulp, {:.3g} rad)'.format(
+            excess, *worst))
+    print('zero-length vectors: {} inputs{}'.format(
+        checker.nzero, ''.join(', ' + behavior for behavior in sorted(checker.invalid))))
+    for failure in checker.failures:
+        print('FAIL {}'.format(failure))
+    return 1 if checker.failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,334 @@
+/*
+ * goldcmp: compare an output with its golden file.
+ *
+ * usage: goldcmp [-q] [-a ABS] [-r REL] GOLDEN RESULT
+ *
+ * Both files are memory-mapped and compared in SIMD blocks, stopping at the
+ * first difference, so an output of hundreds of megabytes costs about one
+ * read of each file and no memory beyond the page cache.  Where they differ,
+ * the line and column and both lines are printed, with a caret under the
+ * column; -q prints nothing.
+ *
+ * With -a or -r, numbers may differ within a tolerance: where the bytes
+ * differ inside a number, the numbers of both files are parsed and taken as
+ * equal when |golden - result| <= ABS + REL * max(|golden|, |result|).  Their
+ * spelling may differ too ("1.0" and "1.000", "1e-3" and "0.001").  All other
+ * bytes have to match exactly.
+ *
+ * The exit status is 0 when the files match, 1 when they differ and 2 on
+ * trouble, as cmp(1) does.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace
+{
+
+/// A file mapped read-only; an empty file has no mapping.
+class MappedFile
+{
+public:
+    MappedFile(MappedFile const & ) = delete;
+    MappedFile & operator=(MappedFile const & ) = delete;
+
+    explicit MappedFile(char const * path)
+    {
+        int const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { m_error = errno; return; }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) { m_error = errno; }
+        else if (!S_ISREG(st.st_mode)) { m_error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL; }
+        else if (st.st_size > 0)
+        {
+            void * const data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) { m_error = errno; }
+            else
+            {
+                m_data = static_cast<char const *>(data);
+                m_size = static_cast<size_t>(st.st_size);
+                ::madvise(data, m_size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (m_data) { ::munmap(const_cast<char *>(m_data), m_size); }
+    }
+
+    char const * data() const { return m_data; }
+    size_t size() const { return m_size; }
+    int error() const { return m_error; }
+
+private:
+    char const * m_data = nullptr;
+    size_t m_size = 0;
+    int m_error = 0;
+}; /* end class MappedFile */
+
+size_t mismatch_scalar(char const * a, char const * b, size_t size)
+{
+    // memcmp is vectorized in the C library; only the differing block is
+    // searched byte by byte.
+    constexpr size_t BLOCK = 4096;
+    size_t it = 0;
+    while (it < size)
+    {
+        size_t const length = std::min(BLOCK, size - it);
+        if (std::memcmp(a + it, b + it, length) != 0) { break; }
+        it += length;
+    }
+    while (it < size && a[it] == b[it]) { ++it; }
+    return it;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2,bmi")))
+size_t mismatch_avx2(char const * a, char const * b, size_t size)
+{
+    size_t it = 0;
+    for (; size - it >= 64; it += 64)
+    {
+        __m256i const a0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + it));
+        __m256i const b0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + it));
+        __m256i const a1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + it + 32));
+        __m256i const b1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + it + 32));
+        unsigned const equal0 = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0)));
+        unsigned const equal1 = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1)));
+        if ((equal0 & equal1) != ~0U)
+        {
+            if (equal0 != ~0U) { return it + _tzcnt_u32(~equal0); }
+            return it + 32 + _tzcnt_u32(~equal1);
+        }
+    }
+    while (it < size && a[it] == b[it]) { ++it; }
+    return it;
+}
+#endif
+
+/// The length of the common prefix of a and b.
+size_t mismatch(char const * a, char const * b, size_t size)
+{
+    using function_type = size_t (*)(char const *, char const *, size_t);
+    static function_type const function = []() -> function_type
+    {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")) { return mismatch_avx2; }
+#endif
+        return mismatch_scalar;
+    }();
+    return function(a, b, size);
+}
+
+bool is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+}
+
+/// Parse the number starting at data[begin] into value; return its end, or begin when there is none.
+size_t parse_number(char const * data, size_t size, size_t begin, double & value)
+{
+    // strtod() needs a terminated string; a number longer than this is not
+    // one that a tolerance is meant for.
+    char buffer[128];
+    size_t length = 0;
+    while (begin + length < size && length + 1 < sizeof(buffer) && is_number_char(data[begin + length]))
+    {
+        buffer[length] = data[begin + length];
+        ++length;
+    }
+    buffer[length] = '\0';
+    char * end = nullptr;
+    value = std::strtod(buffer, &end);
+    return begin + static_cast<size_t>(end - buffer);
+}
+
+struct Tolerance
+{
+    double absolute = 0;
+    double relative = 0;
+    bool enabled() const { return absolute > 0 || relative > 0; }
+}; /* end struct Tolerance */
+
+/*
+ * The bytes at golden[gpos] and result[rpos] differ, the ones before them
+ * back to gsync in the golden file do not.  When the difference is inside a
+ * number in both files and the numbers are close enough, move both positions
+ * past their numbers and return true.
+ *
+ * The numbers are found by reading the run of number characters before the
+ * difference from its start, a number at a time, so that a match never
+ * begins in the middle of one ("5" of "1.5" against "5.2" of "1.5.2"), and
+ * both have to end where their run of number characters ends.
+ */
+bool skip_close_numbers(
+    MappedFile const & golden, MappedFile const & result, Tolerance const & tolerance,
+    size_t gsync, size_t & gpos, size_t & rpos)
+{
+    size_t ahead = 0;
+    while (gpos - ahead > gsync && is_number_char(golden.data()[gpos - ahead - 1])) { ++ahead; }
+    for (;;)
+    {
+        double gvalue = 0;
+        double rvalue = 0;
+        size_t const gstart = gpos - ahead;
+        size_t const rstart = rpos - ahead;
+        size_t const gend = parse_number(golden.data(), golden.size(), gstart, gvalue);
+        size_t const rend = parse_number(result.data(), result.size(), rstart, rvalue);
+        if (gend == gstart || rend == rstart)
+        {
+            // Not a number, like the "e" of "line-2": one may start at the
+            // next character.
+            if (ahead == 0) { return false; }
+            --ahead;
+            continue;
+        }
+        if (gend <= gpos && rend <= rpos)
+        {
+            // A number before the difference: the next one starts after it.
+            if (gend - gstart != rend - rstart) { return false; }
+            ahead -= gend - gstart;
+            continue;
+        }
+        if (gend < golden.size() && is_number_char(golden.data()[gend])) { return false; }
+        if (rend < result.size() && is_number_char(result.data()[rend])) { return false; }
+        if (!std::isfinite(gvalue) || !std::isfinite(rvalue)) { return false; }
+        double const bound = tolerance.absolute + tolerance.relative * std::max(std::fabs(gvalue), std::fabs(rvalue));
+        if (std::fabs(gvalue - rvalue) > bound) { return false; }
+        gpos = gend;
+        rpos = rend;
+        return true;
+    }
+}
+
+/// Where the line holding data[pos] begins.
+size_t line_begin(char const * data, size_t pos)
+{
+    while (pos > 0 && data[pos - 1] != '\n') { --pos; }
+    return pos;
+}
+
+/// Print a line (without its end) shortened to a window around column, and return where column lands in it.
+size_t print_line(char const * prefix, char const * data, size_t size, size_t begin, size_t column)
+{
+    constexpr size_t WIDTH = 120;
+    size_t end = begin;
+    while (end < size && data[end] != '\n') { ++end; }
+    size_t first = begin;
+    if (column > WIDTH / 2) { first = begin + column - WIDTH / 2; }
+    size_t const last = std::min(end, first + WIDTH);
+    std::string text = prefix;
+    if (first > begin) { text += "..."; }
+    size_t const offset = text.size() - std::strlen(prefix) + (begin + column - first);
+    text.append(data + first, last - first);
+    if (last < end) { text += "..."; }
+    if (end == size && end > begin) { text += " (no newline at end of file)"; }
+    std::printf("%s\n", text.c_str());
+    return offset;
+}
+
+int usage()
+{
+    std::fputs("usage: goldcmp [-q] [-a ABS] [-r REL] GOLDEN RESULT\n", stderr);
+    return 2;
+}
+
+} /* end namespace */
+
+int main(int argc, char ** argv)
+{
+    bool quiet = false;
+    Tolerance tolerance;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "qa:r:")) != -1)
+    {
+        char * end = nullptr;
+        switch (opt)
+        {
+        case 'q': quiet = true; break;
+        case 'a':
+        case 'r':
+        {
+            double const value = std::strtod(optarg, &end);
+            if (end == optarg || *end || !(value >= 0)) { return usage(); }
+            (opt == 'a' ? tolerance.absolute : tolerance.relative) = value;
+            break;
+        }
+        default: return usage();
+        }
+    }
+    if (argc - optind != 2) { return usage(); }
+    char const * golden_path = argv[optind];
+    char const * result_path = argv[optind + 1];
+
+    MappedFile const golden(golden_path);
+    MappedFile const result(result_path);
+    for (auto const & file : {std::make_pair(golden_path, &golden), std::make_pair(result_path, &result)})
+    {
+        if (file.second->error())
+        {
+            std::fprintf(stderr, "goldcmp: %s: %s\n", file.first, std::strerror(file.second->error()));
+            return 2;
+        }
+    }
+
+    size_t gpos = 0;
+    size_t rpos = 0;
+    for (;;)
+    {
+        size_t const gsync = gpos;
+        size_t const common = std::min(golden.size() - gpos, result.size() - rpos);
+        size_t const same = common ? mismatch(golden.data() + gpos, result.data() + rpos, common) : 0;
+        gpos += same;
+        rpos += same;
+        if (gpos == golden.size() && rpos == result.size()) { return 0; }
+        if (!tolerance.enabled() || !skip_close_numbers(golden, result, tolerance, gsync, gpos, rpos)) { break; }
+    }
+    if (quiet) { return 1; }
+
+    // Numbers never span lines, so both positions are on the same line.
+    size_t line = 1;
+    for (char const * it = golden.data(), * end = it + gpos;
+         it != end && (it = static_cast<char const *>(std::memchr(it, '\n', static_cast<size_t>(end - it)))); ++it)
+    {
+        ++line;
+    }
+    size_t const gbegin = line_begin(golden.data(), gpos);
+    size_t const rbegin = line_begin(result.data(), rpos);
+    if (gpos == golden.size() && golden.size() == gbegin)
+    {
+        std::printf("goldcmp: %s has more lines than %s: line %zu\n", result_path, golden_path, line);
+    }
+    else if (rpos == result.size() && result.size() == rbegin)
+    {
+        std::printf("goldcmp: %s ends before line %zu of %s\n", result_path, line, golden_path);
+    }
+    else
+    {
+        std::printf("goldcmp: %s differs from %s at line %zu, column %zu (byte %zu)\n",
+                    result_path, golden_path, line, rpos - rbegin + 1, rpos + 1);
+    }
+    size_t const caret = print_line("- ", golden.data(), golden.size(), gbegin, gpos - gbegin);
+    print_line("+ ", result.data(), result.size(), rbegin, rpos - rbegin);
+    std::printf("  %s^\n", std::string(caret, ' ').c_str());
+    return 1;
+}
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,129 @@
+#!/bin/bash
+#
+# Grade many submissions concurrently with a homework's validate.sh.
+#
+# usage: grade.sh [-j N] [-o DIR] [-c] VALIDATE_SH SUBMISSION...
+#
+# Each question of each submission is a stage: "validate.sh QUESTION" runs
+# from the submission directory and makes its own temporary working
+# directory, so no two stages share files.  At most N stages run at once
+# (default: the number of CPUs).  A validate.sh that does not list its
+# questions ("validate.sh --list") is run whole as a single stage.
+#
+# Each stage leaves its output in DIR/SUBMISSION/QUESTION.log, its exit
+# status in QUESTION.status and its wall time in seconds in QUESTION.time; DIR
+# defaults to a new temporary directory.  A validate.sh that times its steps
+# with stagetime (see VALIDATE_REPORT in hw2/validate.sh) writes them to
+# QUESTION.stages.jsonl.  The report gives, under a "#" line
+# per submission, the "GET POINT" lines "validate.sh | grep 'GET POINT'"
+# would print: the questions in order, up to and including the first that
+# failed, since the sequential script exits there.
+#
+# With -c, the compilers make calls go through buildcache.sh, so regrading an
+# unchanged submission takes its objects and modules from the cache instead of
+# compiling them again.
+
+jobs=$(nproc 2>/dev/null || echo 1)
+out_dir=
+cache=
+
+usage() {
+  echo "usage: $(basename $0) [-j N] [-o DIR] [-c] VALIDATE_SH SUBMISSION..." >&2
+  exit 2
+}
+
+while getopts "j:o:ch" opt ; do
+  case $opt in
+    j) jobs=$OPTARG ;;
+    o) out_dir=$OPTARG ;;
+    c) cache=1 ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 2 ] || ! [[ "$jobs" =~ ^[1-9][0-9]*$ ]] ; then usage ; fi
+
+validate="$(realpath "$1")"
+shift
+if [ ! -f "$validate" ] ; then
+  echo "$validate not found" >&2
+  exit 2
+fi
+
+if grep -q -- '"--list"' "$validate" ; then
+  questions=$(bash "$validate" --list 2>/dev/null)
+else
+  questions=all
+fi
+
+if [ -z "$out_dir" ] ; then out_dir=$(mktemp -d -t grade-XXXXXXXXXX) ; fi
+mkdir -p "$out_dir"
+echo "stage output: $out_dir" >&2
+
+stage_path="$PATH"
+if [ -n "$cache" ] ; then
+  shims="$out_dir/.buildcache-bin"
+  "$(dirname "$(realpath "$0")")/buildcache.sh" --shims "$shims" || exit 2
+  stage_path="$shims:$PATH"
+fi
+
+declare -A names
+submissions=()
+for submission in "$@" ; do
+  if [ ! -d "$submission" ] ; then
+    echo "$submission is not a directory" >&2
+    exit 2
+  fi
+  submission="$(realpath "$submission")"
+  name="$(basename "$submission")"
+  if [ -n "${names[$name]}" ] ; then
+    echo "two submissions are named $name" >&2
+    exit 2
+  fi
+  names[$name]=$submission
+  submissions+=("$submission")
+  mkdir -p "$out_dir/$name"
+done
+
+# Run one stage; "all" runs the whole script.
+run_stage() {
+  local submission=$1 question=$2
+  local prefix="$out_dir/$(basename "$submission")/$question"
+  local args=$question
+  if [ "$question" == "all" ] ; then args= ; fi
+  local start=$(date +%s%N)
+  (cd "$submission" && PATH="$stage_path" VALIDATE_REPORT="$prefix.stages.jsonl" bash "$validate" $args) \
+    > "$prefix.log" 2>&1 < /dev/null
+  echo $? > "$prefix.status"
+  local stop=$(date +%s%N)
+  awk "BEGIN { printf \"%.3f\n\", ($stop - $start) / 1e9 }" > "$prefix.time"
+}
+
+start=$(date +%s%N)
+running=0
+for submission in "${submissions[@]}" ; do
+  for question in $questions ; do
+    if [ $running -ge $jobs ] ; then
+      wait -n
+      running=$((running - 1))
+    fi
+    run_stage "$submission" "$question" &
+    running=$((running + 1))
+  done
+done
+wait
+stop=$(date +%s%N)
+
+for submission in "${submissions[@]}" ; do
+  name="$(basename "$submission")"
+  echo "# $name"
+  for question in $questions ; do
+    prefix="$out_dir/$name/$question"
+    grep "GET POINT" "$prefix.log"
+    echo "$name $question: status $(cat "$prefix.status"), $(cat "$prefix.time") s" >&2
+    if [ "$(cat "$prefix.status")" != "0" ] ; then break ; fi
+  done
+done
+awk "BEGIN { printf \"graded ${#submissions[@]} submissions in %.1f s\n\", ($stop - $start) / 1e9 }" >&2
+
+# vim: set fenc=utf8 ff=unix et sw=2 ts=2 sts=2:
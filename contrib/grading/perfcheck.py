@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+
+# Check a submission against the performance baseline of an assignment.
+#
+# The baseline (hw2/perf.txt) lists benchmark commands per question with a
+# latency or throughput bound and a tolerance.  For every question, the
+# question directory of the submission is copied to a temporary directory
+# and built with make; each benchmark command then runs there a few times
+# untimed and REPEAT times timed.  The median and the median absolute
+# deviation (MAD) of the wall times are compared with the bound: a median
+# beyond the bound and its tolerance is a regression.  A MAD larger than the
+# tolerance allows marks the result as noisy, so that a regression on a busy
+# machine can be told from a real one.  The results are written as JSON and
+# summarized on standard error; the exit status is 1 when a benchmark
+# regressed or failed.
+
+import argparse
+import json
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+METRICS = ('latency', 'throughput')
+DURATION_RE = re.compile(r'^(\d+(?:\.\d+)?)(us|ms|s)$')
+RATE_RE = re.compile(r'^(\d+(?:\.\d+)?)/s$')
+TOLERANCE_RE = re.compile(r'^(\d+(?:\.\d+)?)%$')
+UNITS = {'us': 1e-6, 'ms': 1e-3, 's': 1.0}
+
+
+class BaselineError(Exception):
+    pass
+
+
+def parse_baseline(path):
+    """Read the benchmarks of a baseline file as a list of dicts."""
+    benchmarks = []
+    with open(path) as fobj:
+        for number, line in enumerate(fobj, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            fields = line.split(None, 5)
+            where = '{}:{}'.format(path, number)
+            if len(fields) < 6:
+                raise BaselineError('{}: expected QUESTION NAME METRIC BOUND TOLERANCE COMMAND'.format(where))
+            question, name, metric, bound, tolerance, command = fields
+            if metric not in METRICS:
+                raise BaselineError('{}: unknown metric {!r}'.format(where, metric))
+            match = (DURATION_RE if metric == 'latency' else RATE_RE).match(bound)
+            if not match:
+                raise BaselineError('{}: bad {} bound {!r}'.format(where, metric, bound))
+            value = float(match.group(1)) * (UNITS[match.group(2)] if metric == 'latency' else 1.0)
+            match = TOLERANCE_RE.match(tolerance)
+            if not match:
+                raise BaselineError('{}: bad tolerance {!r}'.format(where, tolerance))
+            benchmarks.append({
+                'question': question,
+                'name': name,
+                'metric': metric,
+                'bound': value,
+                'tolerance': float(match.group(1)) / 100,
+                'command': command,
+            })
+    return benchmarks
+
+
+def run_once(command, directory):
+    """Run a command with bash; return (seconds, exit status, last output line)."""
+    start = time.perf_counter()
+    proc = subprocess.run(['bash', '-c', command], cwd=directory, stdin=subprocess.DEVNULL,
+                          stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    lines = proc.stdout.decode('utf-8', 'replace').split()
+    return elapsed, proc.returncode, lines[-1] if lines else ''
+
+
+def measure(benchmark, directory, repeat, warmup):
+    """Time a benchmark and judge it against its bound."""
+    result = {key: benchmark[key] for key in ('question', 'name', 'metric', 'bound', 'tolerance')}
+    for _ in range(warmup):
+        run_once(benchmark['command'], directory)
+    times = []
+    operations = set()
+    for _ in range(repeat):
+        elapsed, returncode, last = run_once(benchmark['command'], directory)
+        if returncode != 0:
+            result.update(status='failed', exit=returncode)
+            return result
+        times.append(elapsed)
+        operations.add(last)
+    median = statistics.median(times)
+    mad = statistics.median(abs(t - median) for t in times)
+    result.update(median_s=median, mad_s=mad, min_s=min(times))
+    tolerance = benchmark['tolerance']
+    if benchmark['metric'] == 'latency':
+        value = median
+        regressed = value > benchmark['bound'] * (1 + tolerance)
+    else:
+        try:
+            count = float(operations.pop()) if len(operations) == 1 else None
+        except ValueError:
+            count = None
+        if not count or median <= 0:
+            result.update(status='failed', exit=0, error='no operation count as the last output line')
+            return result
+        value = count / median
+        regressed = value < benchmark['bound'] * (1 - tolerance)
+    result['value'] = value
+    result['noisy'] = mad > median * tolerance
+    result['status'] = 'regressed' if regressed else 'ok'
+    return result
+
+
+def check_question(submission, question, benchmarks, repeat, warmup, keep):
+    """Build one question of a submission and run its benchmarks."""
+    source = os.path.join(submission, question)
+    if not os.path.isdir(source):
+        return [dict(question=question, name=b['name'], metric=b['metric'], status='failed',
+                     error='no {} directory'.format(question)) for b in benchmarks]
+    directory = tempfile.mkdtemp(prefix='perfcheck-{}-'.format(question))
+    try:
+        work = os.path.join(directory, question)
+        shutil.copytree(source, work, symlinks=True)
+        build = subprocess.run(['make'], cwd=work, stdin=subprocess.DEVNULL,
+                               stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        if build.returncode != 0:
+            return [dict(question=question, name=b['name'], metric=b['metric'], status='failed',
+                         error='make failed with {}'.format(build.returncode)) for b in benchmarks]
+        return [measure(benchmark, work, repeat, warmup) for benchmark in benchmarks]
+    finally:
+        if keep:
+            sys.stderr.write('kept {}\n'.format(directory))
+        else:
+            shutil.rmtree(directory, ignore_errors=True)
+
+
+def format_value(result):
+    if 'value' not in result:
+        return result.get('error', 'exit {}'.format(result.get('exit')))
+    if result['metric'] == 'latency':
+        text = '{:.2f} ms (bound {:.2f} ms)'.format(result['value'] * 1000, result['bound'] * 1000)
+    else:
+        text = '{:.1f}/s (bound {:.1f}/s)'.format(result['value'], result['bound'])
+    text += ' MAD {:.2f} ms'.format(result['mad_s'] * 1000)
+    return text + (' noisy' if result['noisy'] else '')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check a submission against a performance baseline.')
+    parser.add_argument('baseline', help='the baseline file, e.g. hw2/perf.txt')
+    parser.add_argument('submission', help='the submission directory holding q1, q2, ...')
+    parser.add_argument('questions', nargs='*', help='check only these questions')
+    parser.add_argument('--repeat', '-n', type=int, default=7, help='timed runs per benchmark (default 7)')
+    parser.add_argument('--warmup', type=int, default=1, help='untimed runs per benchmark (default 1)')
+    parser.add_argument('--output', '-o', metavar='FILE', help='write the JSON report here (default stdout)')
+    parser.add_argument('--keep', action='store_true', help='keep the build directories')
+    args = parser.parse_args()
+    if args.repeat < 1:
+        parser.error('--repeat must be at least 1')
+
+    try:
+        benchmarks = parse_baseline(args.baseline)
+    except (OSError, BaselineError) as e:
+        sys.stderr.write('{}\n'.format(e))
+        return 2
+    questions = []
+    for benchmark in benchmarks:
+        if benchmark['question'] not in questions:
+            questions.append(benchmark['question'])
+    for question in args.questions:
+        if question not in questions:
+            parser.error('no benchmark for {}'.format(question))
+    selected = [q for q in questions if not args.questions or q in args.questions]
+
+    results = []
+    for question in selected:
+        mine = [b for b in benchmarks if b['question'] == question]
+        for result in check_question(args.submission, question, mine, args.repeat, args.warmup, args.keep):
+            results.append(result)
+            sys.stderr.write('{:<4} {:<12} {:<10} {}\n'.format(
+                result['question'], result['name'], result['status'], format_value(result)))
+
+    report = {
+        'baseline': os.path.abspath(args.baseline),
+        'submission': os.path.abspath(args.submission),
+        'repeat': args.repeat,
+        'results': results,
+    }
+    text = json.dumps(report, indent=2) + '\n'
+    if args.output:
+        with open(args.output, 'w') as fobj:
+            fobj.write(text)
+    else:
+        sys.stdout.write(text)
+    return 1 if any(result['status'] != 'ok' for result in results) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
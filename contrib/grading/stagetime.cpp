@@ -0,0 +1,158 @@
+/*
+ * stagetime: run a command and record what it cost.
+ *
+ * usage: stagetime [-o REPORT] [-n NAME] COMMAND [ARG...]
+ *
+ * The command runs with the standard streams of stagetime, which prints
+ * nothing of its own, so wrapping a stage leaves its output unchanged.  When
+ * it ends, one JSON object is appended to REPORT (standard error without
+ * -o): the stage NAME, the command, its exit status or the signal that
+ * killed it, the wall time, the user and system CPU time, and the peak
+ * resident set size.  They come from wait4(), so they cover the processes
+ * the command waited for too, such as the compilers make runs.  The object
+ * is written with a single append, so concurrent stages may share a report.
+ *
+ * The exit status is that of the command, 128 plus the signal number when a
+ * signal killed it, 127 when it could not be found and 126 when it could not
+ * be run.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace
+{
+
+double seconds(struct timeval const & tv)
+{
+    return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+}
+
+double now()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+/// Append text as a JSON string, quotes included.
+void append_json(std::string & out, char const * text)
+{
+    out += '"';
+    for (; *text; ++text)
+    {
+        unsigned char const c = static_cast<unsigned char>(*text);
+        if (c == '"' || c == '\\') { out += '\\'; out += static_cast<char>(c); }
+        else if (c < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else { out += static_cast<char>(c); }
+    }
+    out += '"';
+}
+
+int usage()
+{
+    std::fputs("usage: stagetime [-o REPORT] [-n NAME] COMMAND [ARG...]\n", stderr);
+    return 2;
+}
+
+} /* end namespace */
+
+int main(int argc, char ** argv)
+{
+    char const * report = nullptr;
+    char const * name = nullptr;
+    int opt;
+    // "+": options end at the command, whose own options are left alone.
+    while ((opt = ::getopt(argc, argv, "+o:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o': report = optarg; break;
+        case 'n': name = optarg; break;
+        default: return usage();
+        }
+    }
+    if (optind >= argc) { return usage(); }
+    char ** command = argv + optind;
+
+    // Like system(): a terminal interrupt is for the command, not for us.
+    struct sigaction ignore, saved_int, saved_quit;
+    std::memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    ::sigaction(SIGINT, &ignore, &saved_int);
+    ::sigaction(SIGQUIT, &ignore, &saved_quit);
+
+    double const start = now();
+    pid_t const pid = ::fork();
+    if (pid < 0)
+    {
+        std::fprintf(stderr, "stagetime: fork: %s\n", std::strerror(errno));
+        return 126;
+    }
+    if (pid == 0)
+    {
+        ::sigaction(SIGINT, &saved_int, nullptr);
+        ::sigaction(SIGQUIT, &saved_quit, nullptr);
+        ::execvp(command[0], command);
+        int const error = errno;
+        std::fprintf(stderr, "stagetime: %s: %s\n", command[0], std::strerror(error));
+        ::_exit(error == ENOENT ? 127 : 126);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    while (::wait4(pid, &status, 0, &usage) < 0)
+    {
+        if (errno != EINTR)
+        {
+            std::fprintf(stderr, "stagetime: wait4: %s\n", std::strerror(errno));
+            return 126;
+        }
+    }
+    double const wall = now() - start;
+    ::sigaction(SIGINT, &saved_int, nullptr);
+    ::sigaction(SIGQUIT, &saved_quit, nullptr);
+
+    std::string out = "{\"stage\": ";
+    if (name) { append_json(out, name); }
+    else { out += "null"; }
+    out += ", \"command\": [";
+    for (char ** it = command; *it; ++it)
+    {
+        if (it != command) { out += ", "; }
+        append_json(out, *it);
+    }
+    char number[256];
+    if (WIFSIGNALED(status)) { std::snprintf(number, sizeof(number), "], \"exit\": null, \"signal\": %d", WTERMSIG(status)); }
+    else { std::snprintf(number, sizeof(number), "], \"exit\": %d, \"signal\": null", WEXITSTATUS(status)); }
+    out += number;
+    std::snprintf(number, sizeof(number),
+                  ", \"wall_s\": %.6f, \"user_s\": %.6f, \"sys_s\": %.6f, \"max_rss_kb\": %ld}\n",
+                  wall, seconds(usage.ru_utime), seconds(usage.ru_stime), usage.ru_maxrss);
+    out += number;
+
+    int const fd = report ? ::open(report, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : STDERR_FILENO;
+    if (fd < 0 || ::write(fd, out.data(), out.size()) != static_cast<ssize_t>(out.size()))
+    {
+        std::fprintf(stderr, "stagetime: %s: %s\n", report ? report : "stderr", std::strerror(errno));
+    }
+    if (report && fd >= 0) { ::close(fd); }
+
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -0,0 +1,42 @@
+# goldcmp exit statuses: run with "make test".
+
+import os
+import subprocess
+
+import pytest
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+GOLDCMP = os.path.join(HERE, '..', 'goldcmp')
+
+
+def goldcmp(tmp_path, golden, result, *options):
+    (tmp_path / 'golden').write_bytes(golden)
+    (tmp_path / 'result').write_bytes(result)
+    return subprocess.run([GOLDCMP, '-q'] + list(options) + [str(tmp_path / 'golden'), str(tmp_path / 'result')]).returncode
+
+
+@pytest.mark.parametrize('golden, result, options, status', [
+    (b'a 1\n', b'a 1\n', [], 0),
+    (b'a 1\n', b'a 2\n', [], 1),
+    (b'a 1\n', b'a 1', [], 1),
+    (b'x = 1.0\n', b'x = 1.000\n', ['-a', '0'], 1),
+    (b'x = 1.0\n', b'x = 1.000\n', ['-a', '1e-9'], 0),
+    (b'x = 1e-3 y\n', b'x = 0.001 y\n', ['-r', '1e-9'], 0),
+    (b'x = 3.25\n', b'x = 3.26\n', ['-a', '0.1'], 0),
+    (b'x = 3.25\n', b'x = 3.36\n', ['-a', '0.1'], 1),
+    (b'x = 15\n', b'x = 25\n', ['-a', '0.5'], 1),
+    # The number starts after "e" of "line", and after the "1" of a range.
+    (b'line-2\n', b'line-3\n', ['-a', '2'], 0),
+    (b'1-2\n', b'1-3\n', ['-a', '2'], 0),
+    # Never compare from the middle of a number, nor a number its run of
+    # number characters goes on after.
+    (b'v=1.5\n', b'v=1.5.2\n', ['-a', '0.5'], 1),
+    (b'v=1.5.2\n', b'v=1.5\n', ['-a', '0.5'], 1),
+    (b'v=1.5\n', b'v=1.52.1\n', ['-a', '0.5'], 1),
+    (b'v=1.5 2.0\n', b'v=1.50 2.00\n', ['-a', '1e-9'], 0),
+], ids=lambda value: repr(value))
+def test_status(tmp_path, golden, result, options, status):
+    assert goldcmp(tmp_path, golden, result, *options) == status
+
+# vim: set ff=unix fenc=utf8 et sw=4 ts=4 sts=4:
@@ -5,82 +5,113 @@ export LC_ALL="en_US.UTF-8"
 
 test_path="$(realpath $(dirname ${BASH_SOURCE[0]}))"
 solution_path="$(realpath .)"
-tmp_dir=$(mktemp -d -t hw2-XXXXXXXXXX)
-
-echo "test path: $test_path"
-echo "working directory: $tmp_dir"
-cd $tmp_dir
 
-# question 1
-echo "empty working directory:"
-rm -rf *
-ls
-
-echo "copy q1 to working directory:"
-cp -a $solution_path/q1/* .
-ls
-
-echo "make:"
-make ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-ls
-
-make
-touch Makefile *.cpp
-make
-
-echo "make run:"
-make run ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-
-ls
-if [ -e "result.txt" ] ; then
-  echo "there should not be result.txt"
-  exit 1
-fi
-
-if [[ "$(uname)" == "Linux" ]] ; then
-  executable="$(find . -executable -type f)"
-else
-  executable="$(find . -perm +111 -type f)"
-fi
-echo "executable: $executable"
-if [ -z "$executable" ] ; then
-  echo "no executable found"
-  exit 1
-fi
-
-echo "make check:"
-make check ; ret=$? # this phony should redirect output to result.txt
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-
-dresult=$(diff $test_path/golden.txt result.txt)
-if [ -n "$dresult" ] ; then
-  echo "golden not pass"
-  exit 1
-fi
-
-cat << EOF
+# Each question is a function run in the working directory; it returns
+# non-zero when grading has to stop.  Without arguments all questions run in
+# order in one working directory.  Naming questions ("validate.sh q2") runs
+# only those, so that a grading runner can give each its own directory;
+# "validate.sh --list" prints the question names.
+questions="q1 q2"
+
+# With VALIDATE_REPORT set, every build and test step runs under
+# contrib/grading/stagetime (make -C contrib/grading), which appends its wall
+# and CPU time, peak RSS and exit status to that file as a JSON line.  Its
+# output is the same either way.
+stagetime="${VALIDATE_STAGETIME:-$test_path/../contrib/grading/stagetime}"
+if [ -n "$VALIDATE_REPORT" ] ; then VALIDATE_REPORT="$(realpath -m "$VALIDATE_REPORT")" ; fi
+
+# contrib/grading/goldcmp, when built, compares the output with the golden
+# file without holding either in memory and shows where they differ; diff is
+# used otherwise.
+goldcmp="${VALIDATE_GOLDCMP:-$test_path/../contrib/grading/goldcmp}"
+
+# stage NAME COMMAND [ARG...]: run the command, timed when asked to.
+stage() {
+  local name=$1 ; shift
+  if [ -n "$VALIDATE_REPORT" ] && [ -x "$stagetime" ] ; then
+    "$stagetime" -o "$VALIDATE_REPORT" -n "$name" "$@"
+  else
+    "$@"
+  fi
+}
+
+q1() {
+
+  # question 1
+  echo "empty working directory:"
+  rm -rf *
+  ls
+
+  echo "copy q1 to working directory:"
+  cp -a $solution_path/q1/* .
+  ls
+
+  echo "make:"
+  stage q1:make make ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+  ls
+
+  stage q1:make-again make
+  touch Makefile *.cpp
+  stage q1:rebuild make
+
+  echo "make run:"
+  stage q1:run make run ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+
+  ls
+  if [ -e "result.txt" ] ; then
+    echo "there should not be result.txt"
+    return 1
+  fi
+
+  if [[ "$(uname)" == "Linux" ]] ; then
+    executable="$(find . -executable -type f)"
+  else
+    executable="$(find . -perm +111 -type f)"
+  fi
+  echo "executable: $executable"
+  if [ -z "$executable" ] ; then
+    echo "no executable found"
+    return 1
+  fi
+
+  echo "make check:"
+  stage q1:check make check ; ret=$? # this phony should redirect output to result.txt
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+
+  if [ -x "$goldcmp" ] ; then
+    "$goldcmp" $test_path/golden.txt result.txt ; ret=$?
+  else
+    dresult=$(diff $test_path/golden.txt result.txt)
+    if [ -n "$dresult" ] ; then ret=1 ; else ret=0 ; fi
+  fi
+  if [ $ret -ne 0 ] ; then
+    echo "golden not pass"
+    return 1
+  fi
+
+  cat << EOF
 Q1 GRADING NOTE: correct implementation gets 1 point.
 EOF
-echo "GET POINT 1"
-
-echo "make clean:"
-make clean ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-
-if [[ "$(uname)" == "Linux" ]] ; then
-  executable="$(find . -executable -type f)"
-else
-  executable="$(find . -perm +111 -type f)"
-fi
-echo "executable: $executable"
-if [ -n "${executable}" ] ; then
-  echo "directory not cleaned"
-  exit 1
-fi
-
-cat << EOF
+  echo "GET POINT 1"
+
+  echo "make clean:"
+  stage q1:clean make clean ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+
+  if [[ "$(uname)" == "Linux" ]] ; then
+    executable="$(find . -executable -type f)"
+  else
+    executable="$(find . -perm +111 -type f)"
+  fi
+  echo "executable: $executable"
+  if [ -n "${executable}" ] ; then
+    echo "directory not cleaned"
+    return 1
+  fi
+
+  cat << EOF
 Q1 GRADING NOTE: correct Makefile gets 1 point:
 * When a source file changes (you can touch it), ``make`` needs to pick it up
   and rebuild.
@@ -88,46 +119,50 @@ Q1 GRADING NOTE: correct Makefile gets 1 point:
   crashing.
 * ``make clean`` needs to remove all the built and intermediate files.
 EOF
-echo "GET POINT 1"
-
-# question 2
-echo "empty working directory:"
-rm -rf *
-ls
-
-echo "copy q2 to working directory:"
-cp -a $solution_path/q2/* .
-ls
-
-echo "make:"
-make ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-ls
-
-make
-touch Makefile *.cpp
-make
-
-sofiles="$(ls *.so)"
-echo "sofiles: $sofiles"
-if [ -z "$sofiles" ] ; then
-  echo "no shared object build"
-  exit 1
-fi
-
-echo "import the extension module:"
-python3 -c 'import _vector ; print(_vector)' ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
-
-cat << EOF
+  echo "GET POINT 1"
+
+}
+
+q2() {
+
+  # question 2
+  echo "empty working directory:"
+  rm -rf *
+  ls
+
+  echo "copy q2 to working directory:"
+  cp -a $solution_path/q2/* .
+  ls
+
+  echo "make:"
+  stage q2:make make ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+  ls
+
+  stage q2:make-again make
+  touch Makefile *.cpp
+  stage q2:rebuild make
+
+  sofiles="$(ls *.so)"
+  echo "sofiles: $sofiles"
+  if [ -z "$sofiles" ] ; then
+    echo "no shared object build"
+    return 1
+  fi
+
+  echo "import the extension module:"
+  stage q2:import python3 -c 'import _vector ; print(_vector)' ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
+
+  cat << EOF
 Q2 GRADING NOTE: correct implementation gets 1 point.
 EOF
 
-echo "run pytest:"
-env PYTHONPATH=".:$PYTHONPATH" python3 -m pytest -v ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
+  echo "run pytest:"
+  stage q2:pytest env PYTHONPATH=".:$PYTHONPATH" python3 -m pytest -v ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
 
-cat << EOF
+  cat << EOF
 Q2 GRADING NOTE: sufficient unit-testing gets 1 point.
 * Test for zero-length 2-vector (invalid input).
 * Test for zero angle.
@@ -135,24 +170,24 @@ Q2 GRADING NOTE: sufficient unit-testing gets 1 point.
 * Test for one other angle.
 * To get full point one has to do at least 2 of the above.
 EOF
-echo "GET POINT 1 (if testing is sufficient)"
+  echo "GET POINT 1 (if testing is sufficient)"
 
-echo "make test:"
-make test ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
+  echo "make test:"
+  stage q2:test make test ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
 
-echo "make clean:"
-make clean ; ret=$?
-if [ $ret -ne 0 ] ; then echo "failure" ; exit 1 ; fi
+  echo "make clean:"
+  stage q2:clean make clean ; ret=$?
+  if [ $ret -ne 0 ] ; then echo "failure" ; return 1 ; fi
 
-sofiles="$(ls *.so)"
-echo "sofiles: $sofiles"
-if [ -n "$sofiles" ] ; then
-  echo "shared object is not deleted"
-  exit 1
-fi
+  sofiles="$(ls *.so)"
+  echo "sofiles: $sofiles"
+  if [ -n "$sofiles" ] ; then
+    echo "shared object is not deleted"
+    return 1
+  fi
 
-cat << EOF
+  cat << EOF
 Q2 GRADING NOTE: correct Makefile gets 1 point.
 * When a source file changes (you can touch it), ``make`` needs to pick it up
   and rebuild.
@@ -160,7 +195,28 @@ Q2 GRADING NOTE: correct Makefile gets 1 point.
 * ``make clean`` removes all the built and intermediate files.
 * To get full point one has to do all 3.
 EOF
-echo "GET POINT 1"
+  echo "GET POINT 1"
+
+}
+
+if [ "$1" == "--list" ] ; then echo $questions ; exit 0 ; fi
+selected="${*:-$questions}"
+for question in $selected ; do
+  if [[ " $questions " != *" $question "* ]] ; then
+    echo "unknown question: $question" >&2
+    exit 2
+  fi
+done
+
+tmp_dir=$(mktemp -d -t hw2-XXXXXXXXXX)
+
+echo "test path: $test_path"
+echo "working directory: $tmp_dir"
+cd $tmp_dir
+
+for question in $selected ; do
+  $question || exit 1
+done
 
 rm -rf $tmp_dir
 